@@ -0,0 +1,21 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Read a biniou AST (see ALSO_WRITE in ASTExporter.h) with the reader
+   generated by atdgen and write it in Yojson. *)
+
+let main =
+  let v = Sys.argv in
+  if Array.length v <> 3 then begin
+    prerr_string ("Usage: " ^ v.(0) ^ " INPUT_FILE OUTPUT_FILE\n");
+    exit 1
+  end;
+  let decl = Ag_util.Biniou.from_file Clang_ast_b.read_decl v.(1) in
+  Yojson_utils.write_data_to_file ~pretty:true Clang_ast_j.write_decl v.(2) decl
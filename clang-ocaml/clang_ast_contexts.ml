@@ -0,0 +1,48 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+type t = {
+  contexts : (Clang_ast_t.pointer, Clang_ast_t.decl_context_name) Hashtbl.t;
+  qual_names : (Clang_ast_t.pointer, string list) Hashtbl.t;
+}
+
+let load fname =
+  let table = Yojson_utils.read_data_from_file Clang_ast_j.read_decl_contexts fname in
+  let contexts = Hashtbl.create 256 in
+  List.iter
+    (fun c -> Hashtbl.replace contexts c.Clang_ast_t.dcn_pointer c)
+    table.Clang_ast_t.dcs_contexts;
+  { contexts; qual_names = Hashtbl.create 256 }
+
+let rec context_qual_name t pointer =
+  try Hashtbl.find t.qual_names pointer
+  with Not_found ->
+    let context = Hashtbl.find t.contexts pointer in
+    let parent_qual_name =
+      match context.Clang_ast_t.dcn_parent with
+        Some parent -> context_qual_name t parent
+      | None -> []
+    in
+    let qual_name = context.Clang_ast_t.dcn_name :: parent_qual_name in
+    Hashtbl.add t.qual_names pointer qual_name;
+    qual_name
+
+let qual_name t info =
+  match info.Clang_ast_t.ni_qual_name with
+    _ :: _ as qual_name -> qual_name
+  | [] ->
+    (* same as NamedDecl::printQualifiedName for unnamed declarations *)
+    let name = if info.Clang_ast_t.ni_name = "" then "(anonymous)" else info.Clang_ast_t.ni_name in
+    let parent_qual_name =
+      match info.Clang_ast_t.ni_context with
+        Some context -> context_qual_name t context
+      | None -> []
+    in
+    name :: parent_qual_name
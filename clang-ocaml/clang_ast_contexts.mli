@@ -0,0 +1,22 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Qualified names of ASTs exported with the plugin option DECL_CONTEXTS_FILE,
+   where named_decl_info records the parent context of a declaration instead
+   of its qualified name. *)
+
+type t
+
+val load : string -> t
+
+(* Qualified name of a declaration, in the same (reversed) order as in
+   named_decl_info. The qualified names of contexts are computed on demand
+   and memoized. Qualified names present in the record are returned as is. *)
+val qual_name : t -> Clang_ast_t.named_decl_info -> string list
@@ -0,0 +1,48 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Check that the qualified names rebuilt from a table of declaration contexts
+   are the ones of a plain export of the same file. *)
+
+module P = Printf
+
+let rec visit_named_decls f decl =
+  let () =
+    match Clang_ast_proj.get_named_decl_tuple decl with
+      Some (_, info) -> f info
+    | None -> ()
+  in
+  match Clang_ast_proj.get_decl_context_tuple decl with
+    Some (l, _) -> List.iter (visit_named_decls f) l
+  | None -> ()
+
+let qual_names get_qual_name fname =
+  let ast = Ag_util.Json.from_file Clang_ast_j.read_decl fname in
+  let names = ref [] in
+  visit_named_decls (fun info -> names := get_qual_name info :: !names) ast;
+  List.rev !names
+
+(* Usage: clang_ast_contexts_test PLAIN_FILE CONTEXTS_FILE TABLE_FILE ... *)
+let main =
+  let v = Sys.argv in
+  let i = ref 1 in
+  while !i + 2 < Array.length v do
+    let plain_file = v.(!i) and contexts_file = v.(!i + 1) in
+    let contexts = Clang_ast_contexts.load v.(!i + 2) in
+    let expected = qual_names (fun info -> info.Clang_ast_t.ni_qual_name) plain_file in
+    let actual = qual_names (Clang_ast_contexts.qual_name contexts) contexts_file in
+    List.iter2
+      (fun e a ->
+        if e <> a then
+          P.printf "%s: %s <> %s\n" contexts_file
+            (String.concat "::" (List.rev e)) (String.concat "::" (List.rev a)))
+      expected actual;
+    i := !i + 3
+  done
@@ -0,0 +1,39 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Version of the dialect understood by this reader *)
+let compact_field_ids_version = 1
+
+(* Field names never start with a digit. *)
+let is_field_id key =
+  key <> "" && key.[0] >= '0' && key.[0] <= '9'
+
+let rec expand_field_ids names json =
+  let expand_tag key =
+    if is_field_id key then names.(int_of_string key) else key
+  in
+  match json with
+  | `Assoc fields -> `Assoc (List.map (fun (key, v) -> (expand_tag key, expand_field_ids names v)) fields)
+  | `List l -> `List (List.map (expand_field_ids names) l)
+  | `Tuple l -> `Tuple (List.map (expand_field_ids names) l)
+  | `Variant (tag, Some v) -> `Variant (tag, Some (expand_field_ids names v))
+  | _ -> json
+
+let read_data_from_file reader fname =
+  let ic = open_in fname in
+  let values = Yojson.Safe.stream_from_channel ~fname ic in
+  let header_json = Stream.next values in
+  let header = Clang_ast_j.field_ids_header_of_string (Yojson.Safe.to_string header_json) in
+  if header.Clang_ast_t.fih_compact_field_ids <> compact_field_ids_version then
+    failwith ("read_data_from_file: unsupported version of the compact dialect in " ^ fname);
+  let names = Array.of_list header.Clang_ast_t.fih_fields in
+  let json = expand_field_ids names (Stream.next values) in
+  close_in ic;
+  (header, Ag_util.Json.from_string ~fname reader (Yojson.Safe.to_string json))
@@ -0,0 +1,19 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Reading ASTs exported with the plugin option COMPACT_FIELD_IDS=1, where
+   field tags are numeric IDs listed in a header record. *)
+
+(* Replace the numeric tags of a JSON value by the corresponding field names.
+   Other tags are kept. *)
+val expand_field_ids : string array -> Yojson.Safe.json -> Yojson.Safe.json
+
+(* Read the header record and the AST that follows it. *)
+val read_data_from_file : 'a Ag_util.Json.reader -> string -> Clang_ast_t.field_ids_header * 'a
@@ -0,0 +1,35 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Declarations indexed by owning module and key. *)
+type t = (string option * string, Clang_ast_t.decl) Hashtbl.t
+
+let create () = Hashtbl.create 256
+
+let rec add_export t decl =
+  let info = Clang_ast_proj.get_decl_tuple decl in
+  (match info.Clang_ast_t.di_key with
+     Some key -> Hashtbl.replace t (info.Clang_ast_t.di_owning_module, key) decl
+   | None -> ());
+  match Clang_ast_proj.get_decl_context_tuple decl with
+    Some (decls, _) -> List.iter (add_export t) decls
+  | None -> ()
+
+let load files =
+  let t = create () in
+  List.iter
+    (fun file -> add_export t (Yojson_utils.read_data_from_file Clang_ast_j.read_decl file))
+    files;
+  t
+
+let resolve t imported_decl =
+  let key = (imported_decl.Clang_ast_t.idr_module_name, imported_decl.Clang_ast_t.idr_key) in
+  try Some (Hashtbl.find t key)
+  with Not_found -> None
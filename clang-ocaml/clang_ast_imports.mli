@@ -0,0 +1,30 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Resolution of the declarations that an AST exported with the plugin option
+   REFERENCE_IMPORTED_DECLS imports from modules or PCHs. These declarations
+   are only represented by imported_decl records, which refer by key to the
+   export of their module (or of the prefix header of a PCH) made once with
+   the plugin option DECL_KEYS. *)
+
+type t
+
+val create : unit -> t
+
+(* Add the declarations of an export made with DECL_KEYS, together with the
+   declarations of their contexts, recursively. *)
+val add_export : t -> Clang_ast_t.decl -> unit
+
+(* [load files] reads the exports of modules or prefix headers. *)
+val load : string list -> t
+
+(* The declaration with the same module and key as the imported_decl record, if
+   one was loaded. *)
+val resolve : t -> Clang_ast_t.imported_decl -> Clang_ast_t.decl option
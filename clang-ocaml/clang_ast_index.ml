@@ -0,0 +1,59 @@
+(*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+type t = {
+  data_file : string;
+  index : Clang_ast_t.decl_index;
+}
+
+let load index_file data_file =
+  let index = Yojson_utils.read_data_from_file Clang_ast_j.read_decl_index index_file in
+  { data_file; index }
+
+let entries t = t.index.Clang_ast_t.dix_decls
+
+let find_by_pointer t pointer =
+  try
+    Some (List.find (fun e -> e.Clang_ast_t.die_pointer = pointer) (entries t))
+  with Not_found -> None
+
+let find_by_qual_name t qual_name =
+  List.filter (fun e -> e.Clang_ast_t.die_qual_name = Some qual_name) (entries t)
+
+let read_range fname range =
+  let ic = open_in_bin fname in
+  let len = range.Clang_ast_t.br_length in
+  let buf = String.create len in
+  seek_in ic range.Clang_ast_t.br_offset;
+  really_input ic buf 0 len;
+  close_in ic;
+  buf
+
+(* Byte ranges include the separator emitted before each element of a list. *)
+let strip_separator s =
+  let n = String.length s in
+  let rec skip i =
+    if i < n then
+      match s.[i] with
+        ',' | ' ' | '\t' | '\n' | '\r' -> skip (i + 1)
+      | _ -> i
+    else i
+  in
+  let i = skip 0 in
+  String.sub s i (n - i)
+
+let read_decl t entry =
+  read_range t.data_file entry.Clang_ast_t.die_range
+  |> strip_separator
+  |> Clang_ast_j.decl_of_string
+
+let read_types t =
+  let s = strip_separator (read_range t.data_file t.index.Clang_ast_t.dix_types) in
+  Ag_oj_run.read_list Clang_ast_j.read_c_type (Yojson.Safe.init_lexer ()) (Lexing.from_string s)
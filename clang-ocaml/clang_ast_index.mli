@@ -0,0 +1,32 @@
+(*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Random access to the top-level declarations of an AST exported together
+   with a declaration index (plugin option DECL_INDEX_FILE). The index is
+   always Json, and so must be the data file: the byte ranges refer to the
+   main output of the plugin, not to a biniou output written with ALSO_WRITE. *)
+
+type t
+
+(* [load index_file data_file] reads the index but not the (uncompressed) AST file. *)
+val load : string -> string -> t
+
+val entries : t -> Clang_ast_t.decl_index_entry list
+
+val find_by_pointer : t -> Clang_ast_t.pointer -> Clang_ast_t.decl_index_entry option
+
+(* Qualified names are given in the same (reversed) order as in named_decl_info. *)
+val find_by_qual_name : t -> string list -> Clang_ast_t.decl_index_entry list
+
+(* Seek to a declaration and parse it. *)
+val read_decl : t -> Clang_ast_t.decl_index_entry -> Clang_ast_t.decl
+
+(* Seek to the table of types of the translation unit and parse it. *)
+val read_types : t -> Clang_ast_t.c_type list
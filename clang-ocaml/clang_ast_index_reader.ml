@@ -0,0 +1,35 @@
+(*
+ *  Copyright (c) 2014, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Print the top-level declarations with a given qualified name (e.g. ns::f)
+   by seeking into an AST file using its declaration index. *)
+
+let main =
+  let v = Sys.argv in
+  if Array.length v <> 4 then begin
+    prerr_string ("Usage: " ^ v.(0) ^ " INDEX_FILE AST_FILE QUALIFIED_NAME\n");
+    exit 1
+  end;
+  try
+    let index = Clang_ast_index.load v.(1) v.(2) in
+    (* qual_name lists are stored innermost name first *)
+    let qual_name = List.rev (List.filter (fun s -> s <> "") (Utils.string_split ':' v.(3))) in
+    List.iter
+      (fun entry ->
+        print_string (Clang_ast_j.string_of_decl (Clang_ast_index.read_decl index entry));
+        print_newline ())
+      (Clang_ast_index.find_by_qual_name index qual_name)
+  with
+    Yojson.Json_error s
+  | Ag_oj_run.Error s -> begin
+    prerr_string s;
+    prerr_newline ();
+    exit 1
+  end
@@ -0,0 +1,53 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Check that seeking into an AST file with its declaration index gives the
+   top-level declarations and the types of the whole AST. Each named
+   declaration is also looked up by its qualified name. *)
+
+module P = Printf
+
+let check index_file ast_file =
+  let error fmt = P.printf ("%s: " ^^ fmt ^^ "\n") index_file in
+  let index = Clang_ast_index.load index_file ast_file in
+  let decls, types =
+    match Yojson_utils.read_data_from_file Clang_ast_j.read_decl ast_file with
+      Clang_ast_t.TranslationUnitDecl (_, decls, _, types) -> (decls, types)
+    | _ -> failwith (ast_file ^ " is not a translation unit")
+  in
+  let entries = Clang_ast_index.entries index in
+  if List.length entries <> List.length decls then
+    error "%d entries for %d declarations" (List.length entries) (List.length decls)
+  else
+    List.iter2
+      (fun entry decl ->
+        let pointer = entry.Clang_ast_t.die_pointer in
+        if Clang_ast_index.read_decl index entry <> decl then
+          error "entry %s is not the declaration in the AST" pointer;
+        match entry.Clang_ast_t.die_qual_name with
+          Some qual_name ->
+            let found = Clang_ast_index.find_by_qual_name index qual_name in
+            if not (List.exists (fun e -> e.Clang_ast_t.die_pointer = pointer) found) then
+              error "entry %s not found by its qualified name %s" pointer
+                (String.concat "::" (List.rev qual_name))
+        | None -> ())
+      entries decls;
+  if Clang_ast_index.read_types index <> types then
+    error "the table of types is not the one in the AST";
+  P.printf "%s: ok\n" (Filename.basename index_file)
+
+(* Usage: clang_ast_index_test INDEX_FILE AST_FILE ... *)
+let main =
+  let v = Sys.argv in
+  let i = ref 1 in
+  while !i + 1 < Array.length v do
+    check v.(!i) v.(!i + 1);
+    i := !i + 2
+  done
@@ -112,17 +112,20 @@ let update_tag_decl_tuple __f = function
 let get_stmt_kind_string = function
 #define STMT(CLASS, PARENT) | CLASS (@CLASS@_tuple) -> s(CLASS)
 #define ABSTRACT_STMT(STMT)
+STMT(NativeFloatingLiteral, Expr) (* floating literals with NATIVE_LITERALS *)
 #include <clang/AST/StmtNodes.inc>
 
 let get_stmt_tuple = function
 #define STMT(CLASS, PARENT) | CLASS (@CLASS@_tuple) -> (stmt_tuple)
 #define ABSTRACT_STMT(STMT)
+STMT(NativeFloatingLiteral, Expr) (* floating literals with NATIVE_LITERALS *)
 #include <clang/AST/StmtNodes.inc>
 
 let update_stmt_tuple __f = function
 #define STMT(CLASS, PARENT) | CLASS (@CLASS@_tuple) -> \
     let (stmt_tuple) = __f (stmt_tuple) in CLASS (@CLASS@_tuple)
 #define ABSTRACT_STMT(STMT)
+STMT(NativeFloatingLiteral, Expr) (* floating literals with NATIVE_LITERALS *)
 #include <clang/AST/StmtNodes.inc>
 
 
@@ -130,6 +133,7 @@ let get_expr_tuple = function
 #define STMT(CLASS, PARENT)
 #define EXPR(CLASS, PARENT) | CLASS (@CLASS@_tuple) -> Some (expr_tuple)
 #define ABSTRACT_STMT(STMT)
+EXPR(NativeFloatingLiteral, Expr) (* floating literals with NATIVE_LITERALS *)
 #include <clang/AST/StmtNodes.inc>
 | _ -> None
 
@@ -138,6 +142,7 @@ let update_expr_tuple __f = function
 #define EXPR(CLASS, PARENT) | CLASS (@CLASS@_tuple) -> \
     let (expr_tuple) = __f (expr_tuple) in CLASS (@CLASS@_tuple)
 #define ABSTRACT_STMT(STMT)
+EXPR(NativeFloatingLiteral, Expr) (* floating literals with NATIVE_LITERALS *)
 #include <clang/AST/StmtNodes.inc>
 | x -> x
 
@@ -33,17 +33,22 @@ let decl_info start stop = {
   di_is_this_declaration_referenced = false;
   di_is_invalid_decl = false;
   di_attributes = [];
-  di_full_comment = None
+  di_full_comment = None;
+  di_truncation = None;
+  di_imported_decl = None;
+  di_key = None
 }
 
 let name_info name = {
   ni_name = name;
-  ni_qual_name = [name]
+  ni_qual_name = [name];
+  ni_context = None
 }
 
 let append_name_info info suffix = {
   ni_name = info.ni_name ^ suffix;
-  ni_qual_name = List.map (fun x -> x ^ suffix) info.ni_qual_name
+  ni_qual_name = List.map (fun x -> x ^ suffix) info.ni_qual_name;
+  ni_context = info.ni_context
 }
 
 let () =
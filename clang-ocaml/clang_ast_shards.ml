@@ -0,0 +1,33 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+let read_manifest fname =
+  Yojson_utils.read_data_from_file Clang_ast_j.read_shard_manifest fname
+
+(* Shards are stored next to the manifest. *)
+let shard_files fname =
+  let dir = Filename.dirname fname in
+  List.map
+    (fun info -> Filename.concat dir info.Clang_ast_t.shi_file)
+    (read_manifest fname).Clang_ast_t.smf_shards
+
+let read_merged_translation_unit fname =
+  let read_shard file =
+    match Yojson_utils.read_data_from_file Clang_ast_j.read_decl file with
+    | Clang_ast_t.TranslationUnitDecl (decl_info, decls, decl_context_info, types) ->
+      (decl_info, decls, decl_context_info, types)
+    | _ -> failwith ("read_merged_translation_unit: " ^ file ^ " is not a translation unit")
+  in
+  match List.map read_shard (shard_files fname) with
+  | [] -> failwith ("read_merged_translation_unit: no shard in " ^ fname)
+  | (decl_info, _, decl_context_info, _) :: _ as shards ->
+    let decls = List.concat (List.map (fun (_, decls, _, _) -> decls) shards)
+    and types = List.concat (List.map (fun (_, _, _, types) -> types) shards) in
+    Clang_ast_t.TranslationUnitDecl (decl_info, decls, decl_context_info, types)
@@ -0,0 +1,22 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Reading ASTs exported with the plugin option SHARDS=N. Manifests and
+   shards are read as Json: shards of a biniou output written with
+   ALSO_WRITE are not listed in the manifest. *)
+
+val read_manifest : string -> Clang_ast_t.shard_manifest
+
+(* Paths of the shards listed in a manifest file, in order. *)
+val shard_files : string -> string list
+
+(* Read all the shards of a manifest and merge them into a single
+   TranslationUnitDecl. Pointers are shared across shards. *)
+val read_merged_translation_unit : string -> Clang_ast_t.decl
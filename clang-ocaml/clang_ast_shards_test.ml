@@ -0,0 +1,95 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Check that the shards of an export made with SHARDS=N decode, that their
+   manifest describes them, and that once merged, they have the declarations
+   and the resolved declaration references of a plain export of the same file. *)
+
+module P = Printf
+
+let translation_unit file = function
+  | Clang_ast_t.TranslationUnitDecl (_, decls, _, types) -> (decls, types)
+  | _ -> failwith (file ^ " is not a translation unit")
+
+(* Kinds and names of the top-level declarations, sorted since shards do not
+   keep the order of the declarations. *)
+let top_level_names decls =
+  let name decl =
+    let kind = Clang_ast_proj.get_decl_kind_string decl in
+    match Clang_ast_proj.get_named_decl_tuple decl with
+      Some (_, info) -> kind ^ " " ^ info.Clang_ast_t.ni_name
+    | None -> kind
+  in
+  List.sort compare (List.map name decls)
+
+(* Collect the values of the pointer fields, and the list of the values of the
+   decl_pointer fields. Pointers are compared as Json values. *)
+let rec collect_pointers pointers decl_pointers json =
+  match json with
+    `Assoc fields ->
+      List.iter
+        (fun (key, value) ->
+          if key = "pointer" then
+            Hashtbl.replace pointers (Yojson.Safe.to_string value) ()
+          else if key = "decl_pointer" then
+            decl_pointers := Yojson.Safe.to_string value :: !decl_pointers;
+          collect_pointers pointers decl_pointers value)
+        fields
+  | `List l | `Tuple l -> List.iter (collect_pointers pointers decl_pointers) l
+  | `Variant (_, Some value) -> collect_pointers pointers decl_pointers value
+  | _ -> ()
+
+(* Number of declaration references, and number of those that do not point
+   to a node of the AST. *)
+let count_decl_refs decl =
+  let json = Yojson.Safe.from_string (Clang_ast_j.string_of_decl decl) in
+  let pointers = Hashtbl.create 1024 and decl_pointers = ref [] in
+  collect_pointers pointers decl_pointers json;
+  let unresolved = List.filter (fun p -> not (Hashtbl.mem pointers p)) !decl_pointers in
+  (List.length !decl_pointers, List.length unresolved)
+
+let check_manifest manifest_file =
+  let manifest = Clang_ast_shards.read_manifest manifest_file in
+  let files = Clang_ast_shards.shard_files manifest_file in
+  let error fmt = P.printf ("%s: " ^^ fmt ^^ "\n") manifest_file in
+  (* shard 0 is the output file given to the plugin *)
+  if List.hd files <> Filename.chop_suffix manifest_file ".manifest" then
+    error "first shard %s is not the main output" (List.hd files);
+  List.iteri
+    (fun i (info, file) ->
+      let decls, types = translation_unit file (Yojson_utils.read_data_from_file Clang_ast_j.read_decl file) in
+      if List.length decls <> info.Clang_ast_t.shi_decl_count then
+        error "%s has %d declarations instead of %d" file (List.length decls) info.Clang_ast_t.shi_decl_count;
+      if info.Clang_ast_t.shi_has_types <> (i = 0) || (types <> []) <> (i = 0) then
+        error "%s: only the first shard should have types" file)
+    (List.combine manifest.Clang_ast_t.smf_shards files);
+  List.length files
+
+(* Usage: clang_ast_shards_test PLAIN_FILE MANIFEST_FILE ... *)
+let main =
+  let v = Sys.argv in
+  let i = ref 1 in
+  while !i + 1 < Array.length v do
+    let plain_file = v.(!i) and manifest_file = v.(!i + 1) in
+    let num_shards = check_manifest manifest_file in
+    let plain = Yojson_utils.read_data_from_file Clang_ast_j.read_decl plain_file in
+    let merged = Clang_ast_shards.read_merged_translation_unit manifest_file in
+    let plain_decls, _ = translation_unit plain_file plain
+    and merged_decls, _ = translation_unit manifest_file merged in
+    if top_level_names plain_decls <> top_level_names merged_decls then
+      P.printf "%s: the top-level declarations differ from %s\n" manifest_file plain_file;
+    let plain_refs, plain_unresolved = count_decl_refs plain
+    and merged_refs, merged_unresolved = count_decl_refs merged in
+    if plain_refs <> merged_refs || plain_unresolved <> merged_unresolved then
+      P.printf "%s: %d declaration references, %d unresolved, instead of %d, %d unresolved\n"
+        manifest_file merged_refs merged_unresolved plain_refs plain_unresolved;
+    P.printf "%s: %d shards\n" (Filename.basename manifest_file) num_shards;
+    i := !i + 2
+  done
@@ -0,0 +1,39 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* The first occurrence of a shared record always precedes its references in
+   the output, so a single left-to-right traversal is enough. *)
+let expand json =
+  let table = Hashtbl.create 1024 in
+  let rec expand_json json =
+    match json with
+    | `Assoc [("@shared", `Int id); ("@value", value)] ->
+      let value = expand_json value in
+      Hashtbl.replace table id value;
+      value
+    | `Assoc [("@ref", `Int id)] ->
+      (try Hashtbl.find table id with
+        Not_found -> failwith ("Clang_ast_shared.expand: undefined reference " ^ string_of_int id))
+    | `Assoc fields -> `Assoc (List.map (fun (name, value) -> (name, expand_json value)) fields)
+    | `List l -> `List (List.map expand_json l)
+    | `Tuple l -> `Tuple (List.map expand_json l)
+    | `Variant (name, Some value) -> `Variant (name, Some (expand_json value))
+    | _ -> json
+  in
+  expand_json json
+
+let decl_of_json json =
+  Clang_ast_j.decl_of_string (Yojson.Safe.to_string (expand json))
+
+let decl_of_string s =
+  decl_of_json (Yojson.Safe.from_string s)
+
+let read_decl_from_file fname =
+  decl_of_json (Yojson.Safe.from_file fname)
@@ -0,0 +1,20 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Decoding of ASTs exported with the plugin option SHARE_RECORDS=1.
+   Shared records are written {"@shared" : id, "@value" : record} the first
+   time and {"@ref" : id} afterwards. *)
+
+(* Replace shared values and back-references by the records they stand for. *)
+val expand : Yojson.Safe.json -> Yojson.Safe.json
+
+val decl_of_string : string -> Clang_ast_t.decl
+
+val read_decl_from_file : string -> Clang_ast_t.decl
@@ -0,0 +1,21 @@
+(*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ *)
+
+(* Read an AST written with shared records (see SHARE_RECORDS in
+   ASTExporter.h) and write it in Yojson with the records expanded. *)
+
+let main =
+  let v = Sys.argv in
+  if Array.length v <> 3 then begin
+    prerr_string ("Usage: " ^ v.(0) ^ " INPUT_FILE OUTPUT_FILE\n");
+    exit 1
+  end;
+  let decl = Clang_ast_shared.read_decl_from_file v.(1) in
+  Yojson_utils.write_data_to_file ~pretty:true Clang_ast_j.write_decl v.(2) decl
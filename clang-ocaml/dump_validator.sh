@@ -0,0 +1,21 @@
+#!/bin/bash
+# Script to validate outputs in formats other than Yojson (biniou, compact field IDs, shared records) w.r.t. ATD specifications.
+# Each file FILE comes with a Yojson dump FILE.yjson written by the same traversal, or by a deterministic export of the same file.
+# This works by running a given 'converter' to parse the file and print it in Yojson, then observing the difference with the pretty-printed Yojson dump.
+# A line is printed for each file that passes the validation.
+
+CONVERTER="$1"
+shift
+
+while [ -n "$1" ]
+do
+    if ! diff -q <(ydump "$1.yjson") <("$CONVERTER" "$1" /dev/stdout) >/dev/null 2>&1; then
+        echo "The file '$1' does not respect the ATD format implemented by $CONVERTER."
+        echo "Here is the command that shows the problem:"
+        echo "  diff <(ydump \"$1.yjson\") <(\"$CONVERTER\" \"$1\" /dev/stdout)"
+        exit 2
+    fi
+    echo "$(basename "$1"): ok"
+
+    shift;
+done
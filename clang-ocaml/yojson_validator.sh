@@ -1,6 +1,7 @@
 #!/bin/bash
 # Script to validate Yojson outputs w.r.t. ATD specifications.
 # This works by running a given 'converter' to parse and pretty-print the outputs, then observing the difference with gunzip + pretty-print.
+# A line is printed for each file that passes the validation.
 
 if [ "$2" == "--std" ]; then
     CONVERTER=("$1" --std --pretty)
@@ -32,6 +33,7 @@ do
         echo "/dev/stdout)"
         exit 2
     fi
+    echo "$(basename "$1"): ok"
 
     shift;
 done
@@ -16,43 +16,43 @@
 #include "ASTExporter.h"
 
 //===----------------------------------------------------------------------===//
-// ASTExporter Plugin Main
+// Static checks of the tuple size tables
 //===----------------------------------------------------------------------===//
 
 namespace {
 
   using namespace ASTLib;
-  using namespace ASTPluginLib;
-
-  template <
-    class ATDWriter=JsonWriter,
-    bool ForceYojson=false
-  >
-  class ExporterASTConsumer : public ASTConsumer {
-  private:
-    ASTExporterOptions Options;
-    raw_ostream &OS;
-
-  public:
-    ExporterASTConsumer(const CompilerInstance &CI,
-                        std::unique_ptr<ASTExporterOptions> &&Opts,
-                        raw_ostream &OS)
-    : Options(std::move(*Opts)), OS(OS)
-    {
-      if (ForceYojson) {
-        this->Options.atdWriterOptions.useYojson = true;
-      }
-    }
-
-    virtual void HandleTranslationUnit(ASTContext &Context) {
-      TranslationUnitDecl *D = Context.getTranslationUnitDecl();
-      ASTExporter<ATDWriter> P(OS, Context, Options);
-      P.dumpDecl(D);
-    }
-  };
+
+  typedef TupleSizeTables<ASTExporter<>> Tables;
+
+  // The tables must have one entry per Decl::Kind and Stmt::StmtClass.
+  static_assert(sizeof(Tables::declKindTupleSizes) / sizeof(int) == Decl::lastDecl + 1,
+                "wrong number of Decl kinds");
+  static_assert(sizeof(Tables::stmtClassTupleSizes) / sizeof(int) == Stmt::lastStmtConstant + 1,
+                "wrong number of Stmt classes");
+
+  // Sizes of a few tuples, as defined by the ATD types.
+  // decl_tuple
+  static_assert(Tables::declKindTupleSizes[Decl::Empty] == 1,
+                "wrong tuple size for EmptyDecl");
+  // decl_tuple * decl_context_tuple * c_type list
+  static_assert(Tables::declKindTupleSizes[Decl::TranslationUnit] == 4,
+                "wrong tuple size for TranslationUnitDecl");
+  // stmt_tuple
+  static_assert(Tables::stmtClassTupleSizes[Stmt::NullStmtClass] == 2,
+                "wrong tuple size for NullStmt");
+  // expr_tuple * integer_literal_info
+  static_assert(Tables::stmtClassTupleSizes[Stmt::IntegerLiteralClass] == 4,
+                "wrong tuple size for IntegerLiteral");
 
 }
 
+//===----------------------------------------------------------------------===//
+// ASTExporter Plugin Main
+//===----------------------------------------------------------------------===//
+
+using namespace ASTLib;
+
 typedef ASTPluginLib::SimplePluginASTAction<ExporterASTConsumer<JsonWriter, false>, ASTExporterOptions> JsonExporterASTAction;
 typedef ASTPluginLib::SimplePluginASTAction<ExporterASTConsumer<JsonWriter, true>, ASTExporterOptions> YojsonExporterASTAction;
 
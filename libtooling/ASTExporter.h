@@ -23,6 +23,12 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <set>
+#include <tuple>
+#include <unordered_set>
+
 #include <clang/AST/ASTContext.h>
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/Attr.h>
@@ -30,7 +36,9 @@
 #include <clang/AST/DeclCXX.h>
 #include <clang/AST/DeclLookups.h>
 #include <clang/AST/DeclObjC.h>
+#include <clang/AST/DeclTemplate.h>
 #include <clang/AST/DeclVisitor.h>
+#include <clang/AST/Mangle.h>
 #include <clang/AST/StmtVisitor.h>
 #include <clang/AST/TypeVisitor.h>
 #include <clang/Basic/Module.h>
@@ -40,10 +48,15 @@
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendDiagnostic.h>
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include "atdlib/ATDWriter.h"
-#include "AttrParameterVectorStream.h"
+#include "build/atd_records.h"
+#include "AttrParameterStream.h"
+#include "ExporterArena.h"
 #include "SimplePluginASTAction.h"
 
 //===----------------------------------------------------------------------===//
@@ -52,18 +65,226 @@
 
 namespace ASTLib {
 
+/// Numbering of all the field names of the ATD specifications of this file,
+/// for the compact JSON dialect.
+inline const ATDWriter::FieldIds &astFieldIds() {
+  static const ATDWriter::FieldIds Ids(ATDRecords::FieldNames);
+  return Ids;
+}
+
 struct ASTExporterOptions : ASTPluginLib::PluginASTOptionsBase {
   bool withPointers = true;
   ATDWriter::ATDWriterOptions atdWriterOptions = {
     .useYojson = false,
     .prettifyJson = true,
+    .fieldIds = nullptr,
+  };
+  /* Optional sidecar file recording the byte range of each top-level declaration in the output.
+     The index is always written in Json (or Yojson), and the ranges refer to the main output,
+     not to the extra outputs of ALSO_WRITE. */
+  std::string declIndexFile;
+  /* Split the top-level declarations of the translation unit across this many output files.
+     The extra outputs of ALSO_WRITE are split the same way, but the manifest only lists the
+     shards of the main output and is always written in Json (or Yojson). */
+  unsigned long shards = 1;
+  /* Emit repeated qual_type and decl_ref records as references to their first occurrence.
+     Json and Yojson only: ignored when a biniou output is requested with ALSO_WRITE. */
+  bool shareRecords = false;
+  /* Emit a structural hash of each function, method and block body. */
+  bool bodyHashes = false;
+  /* Optional sidecar file listing the body hash of each function, method and block. */
+  std::string bodyHashManifest;
+  /* Optional sidecar file listing the call and reference edges found in the
+     bodies of functions, methods and blocks. */
+  std::string referenceGraphFile;
+  /* Optional sidecar file with counters of the export, e.g. the hit rate of
+     the cache of Objective-C method lookups. */
+  std::string profileFile;
+  /* Optional sidecar file with the name and parent of each declaration context
+     used by a qualified name. When given, named_decl_info records the parent
+     context of the declaration instead of its qualified name. */
+  std::string declContextsFile;
+  /* Only export the declarations of the main file and the declarations and
+     types that they use, transitively. */
+  bool exportReferencedOnly = false;
+  /* Make the output only depend on the input, e.g. for build caches: pointers
+     are numbered in order of first occurrence from one translation unit to the
+     next, the type table lists the types in order of first reference, paths
+     are made relative with MAKE_RELATIVE_TO (without KEEP_EXTERNAL_PATHS), and
+     AST_WITH_POINTERS and MAX_EXPORT_SECONDS are ignored. */
+  bool deterministic = false;
+  /* Dump declarations imported from modules or PCHs as references instead of
+     deserializing and dumping them again. The declarations of a context that
+     were not deserialized at all are not exported, and the context is marked
+     with has_external_lexical_storage. */
+  bool referenceImportedDecls = false;
+  /* Give each declaration the key that identifies it in the imported_decl records
+     of other exports. Export modules and prefix headers with this option to
+     resolve the declarations that their importers refer to. */
+  bool declKeys = false;
+  /* Export the documentation comments attached to declarations. */
+  bool exportComments = true;
+  /* Resource budgets of each output file. Zero means unlimited. Declarations and
+     statements beyond a budget are replaced by truncation markers. The type table
+     is not counted and always written in full: the declarations dumped before the
+     budget ran out refer to its entries, which truncating it would leave dangling. */
+  unsigned long maxNodes = 0;
+  unsigned long maxOutputBytes = 0;
+  unsigned long maxExportSeconds = 0;
+  /* Function, method and block bodies with more statements than this are truncated. */
+  unsigned long maxBodyNodes = 0;
+  /* Validate the structure of the output of one translation unit in this many,
+     chosen by a hash of the input file name (0: never, 1: always). */
+#ifdef DEBUG
+  unsigned long validateOneTUIn = 1;
+#else
+  unsigned long validateOneTUIn = 0;
+#endif
+  /* Only validate the first values of each output file. Zero means unlimited. */
+  unsigned long validateMaxNodes = 0;
+  /* Dump chains of ImplicitCastExpr and ParenExpr nodes as a list of
+     collapsed wrappers attached to the innermost expression. */
+  bool collapseImplicitCasts = false;
+  /* Also write the values of integer and floating literals as numbers when
+     they fit in an OCaml int or in a double, next to their decimal strings. */
+  bool nativeLiterals = false;
+  /* Write the field tags of the AST as numeric IDs. The IDs are listed in a
+     header record written before the AST. Other outputs keep the field names. */
+  bool compactFieldIds = false;
+  /* Extra outputs written during the same traversal, given as a comma-separated
+     list of FORMAT:FILE where FORMAT is json, yojson or biniou (e.g. ALSO_WRITE=biniou:%.bin). */
+  struct ExtraOutput {
+    std::string format;
+    std::string file;
   };
+  std::vector<ExtraOutput> extraOutputs;
 
   void loadValuesFromEnvAndMap(const ASTPluginLib::PluginASTOptionsBase::argmap_t &map)  {
     ASTPluginLib::PluginASTOptionsBase::loadValuesFromEnvAndMap(map);
     loadBool(map, "AST_WITH_POINTERS", withPointers);
     loadBool(map, "USE_YOJSON", atdWriterOptions.useYojson);
     loadBool(map, "PRETTIFY_JSON", atdWriterOptions.prettifyJson);
+    loadString(map, "DECL_INDEX_FILE", declIndexFile);
+    loadBool(map, "BODY_HASHES", bodyHashes);
+    loadString(map, "BODY_HASH_MANIFEST", bodyHashManifest);
+    loadString(map, "REFERENCE_GRAPH_FILE", referenceGraphFile);
+    loadString(map, "PROFILE_FILE", profileFile);
+    loadString(map, "DECL_CONTEXTS_FILE", declContextsFile);
+    loadBool(map, "EXPORT_REFERENCED_ONLY", exportReferencedOnly);
+    loadBool(map, "DETERMINISTIC", deterministic);
+    loadUnsignedInt(map, "SHARDS", shards);
+    loadBool(map, "SHARE_RECORDS", shareRecords);
+    loadBool(map, "EXPORT_COMMENTS", exportComments);
+    loadBool(map, "REFERENCE_IMPORTED_DECLS", referenceImportedDecls);
+    loadBool(map, "DECL_KEYS", declKeys);
+    loadUnsignedInt(map, "MAX_NODES", maxNodes);
+    loadUnsignedInt(map, "MAX_OUTPUT_BYTES", maxOutputBytes);
+    loadUnsignedInt(map, "MAX_EXPORT_SECONDS", maxExportSeconds);
+    loadUnsignedInt(map, "MAX_BODY_NODES", maxBodyNodes);
+    loadUnsignedInt(map, "VALIDATE_ONE_TU_IN", validateOneTUIn);
+    loadUnsignedInt(map, "VALIDATE_MAX_NODES", validateMaxNodes);
+    loadBool(map, "COMPACT_FIELD_IDS", compactFieldIds);
+    loadBool(map, "COLLAPSE_IMPLICIT_CASTS", collapseImplicitCasts);
+    loadBool(map, "NATIVE_LITERALS", nativeLiterals);
+    std::string alsoWrite;
+    if (loadString(map, "ALSO_WRITE", alsoWrite)) {
+      extraOutputs = parseExtraOutputs(alsoWrite);
+    }
+    if (shareRecords) {
+      for (const ExtraOutput &output : extraOutputs) {
+        if (output.format == "biniou") {
+          llvm::errs() << "Ignoring SHARE_RECORDS, which is not supported by the biniou output "
+                       << output.file << "\n";
+          shareRecords = false;
+          break;
+        }
+      }
+    }
+    if (deterministic) {
+      withPointers = false;
+      maxExportSeconds = 0;
+      // Paths are only made relative to the repo root once made absolute.
+      // Relative paths are resolved against the repo root rather than the
+      // current directory, and paths outside of the repo root are dropped,
+      // so that no absolute path depends on where the compiler runs.
+      if (repoRoot != "") {
+        if (basePath == "") {
+          basePath = repoRoot;
+        }
+        keepExternalPaths = false;
+      }
+    }
+  }
+
+  void setObjectFile(const std::string &path) {
+    ASTPluginLib::PluginASTOptionsBase::setObjectFile(path);
+    // Same "%.bla" pattern as for the output file.
+    if (path != "" && declIndexFile.size() > 0 && declIndexFile[0] == '%') {
+      declIndexFile = path + declIndexFile.substr(1);
+    }
+    if (path != "" && bodyHashManifest.size() > 0 && bodyHashManifest[0] == '%') {
+      bodyHashManifest = path + bodyHashManifest.substr(1);
+    }
+    if (path != "" && referenceGraphFile.size() > 0 && referenceGraphFile[0] == '%') {
+      referenceGraphFile = path + referenceGraphFile.substr(1);
+    }
+    if (path != "" && profileFile.size() > 0 && profileFile[0] == '%') {
+      profileFile = path + profileFile.substr(1);
+    }
+    if (path != "" && declContextsFile.size() > 0 && declContextsFile[0] == '%') {
+      declContextsFile = path + declContextsFile.substr(1);
+    }
+    for (ExtraOutput &output : extraOutputs) {
+      if (path != "" && output.file.size() > 0 && output.file[0] == '%') {
+        output.file = path + output.file.substr(1);
+      }
+    }
+  }
+
+  static std::vector<ExtraOutput> parseExtraOutputs(const std::string &spec) {
+    std::vector<ExtraOutput> outputs;
+    size_t start = 0;
+    while (start < spec.size()) {
+      size_t end = spec.find(',', start);
+      if (end == std::string::npos) {
+        end = spec.size();
+      }
+      std::string item = spec.substr(start, end - start);
+      start = end + 1;
+      size_t colon = item.find(':');
+      ExtraOutput output;
+      if (colon != std::string::npos) {
+        output.format = item.substr(0, colon);
+        output.file = item.substr(colon + 1);
+      }
+      if ((output.format != "json" && output.format != "yojson" && output.format != "biniou")
+          || output.file == "") {
+        llvm::errs() << "Ignoring invalid extra output '" << item
+                     << "', expected json:FILE, yojson:FILE or biniou:FILE\n";
+        continue;
+      }
+      outputs.push_back(output);
+    }
+    return outputs;
+  }
+
+  // Options of the writer of the AST itself.
+  ATDWriter::ATDWriterOptions astWriterOptions() const {
+    ATDWriter::ATDWriterOptions options = atdWriterOptions;
+    if (compactFieldIds) {
+      options.fieldIds = &astFieldIds();
+    }
+    return options;
+  }
+
+  // The input file is only known once the options are loaded.
+  bool shouldValidateOutput() const {
+    return validateOneTUIn != 0 && std::hash<std::string>()(inputFile) % validateOneTUIn == 0;
+  }
+
+  // Shard 0 is the main output file. Other shards use numbered siblings.
+  static std::string shardFileName(const std::string &file, unsigned shard) {
+    return shard == 0 ? file : file + ".shard" + std::to_string(shard);
   }
 
 };
@@ -71,53 +292,371 @@ struct ASTExporterOptions : ASTPluginLib::PluginASTOptionsBase {
 using namespace clang;
 using namespace clang::comments;
 
+// Descriptors of the ATD record types, generated from the \atd annotations
+// of this file. They are used to count the fields of an object.
+namespace atd = ATDRecords;
+using ::ATDWriter::RecordFields;
+
+// The tuple sizes only depend on the schema: they are constexpr, and the
+// tuple size of each Decl kind and Stmt class is looked up in a table.
+// The tables are kept out of TupleSizeBase, whose Impl is still incomplete
+// when TupleSizeBase is instantiated.
+template<class Impl>
+struct TupleSizeTables {
+  // indexed by Decl::Kind
+  static constexpr int declKindTupleSizes[] = {
+#define DECL(DERIVED, BASE) Impl::DERIVED##DeclTupleSize(),
+#define ABSTRACT_DECL(DECL)
+#include <clang/AST/DeclNodes.inc>
+  };
+
+  // indexed by Stmt::StmtClass
+  static constexpr int stmtClassTupleSizes[] = {
+    0, // NoStmtClass
+#define STMT(CLASS, PARENT) Impl::CLASS##TupleSize(),
+#define ABSTRACT_STMT(STMT)
+#include <clang/AST/StmtNodes.inc>
+  };
+};
+
 template<class Impl>
 struct TupleSizeBase {
   // Decls
 
 #define DECL(DERIVED, BASE)                                \
-  int DERIVED##DeclTupleSize() {                           \
-    return static_cast<Impl*>(this)->BASE##TupleSize();    \
+  static constexpr int DERIVED##DeclTupleSize() {          \
+    return Impl::BASE##TupleSize();                        \
   }
 #define ABSTRACT_DECL(DECL) DECL
 #include <clang/AST/DeclNodes.inc>
 
-  int tupleSizeOfDeclKind(const Decl::Kind kind) {
-    switch (kind) {
-#define DECL(DERIVED, BASE)                                             \
-      case Decl::DERIVED:                                               \
-        return static_cast<Impl*>(this)->DERIVED##DeclTupleSize();
-#define ABSTRACT_DECL(DECL)
-#include <clang/AST/DeclNodes.inc>
-    }
-    llvm_unreachable("Decl that isn't part of DeclNodes.inc!");
+  static int tupleSizeOfDeclKind(const Decl::Kind kind) {
+    return TupleSizeTables<Impl>::declKindTupleSizes[kind];
   }
 
   // Stmts
 
 #define STMT(CLASS, PARENT)                                     \
-  virtual int CLASS##TupleSize() {                              \
-    return static_cast<Impl*>(this)->PARENT##TupleSize();       \
+  static constexpr int CLASS##TupleSize() {                     \
+    return Impl::PARENT##TupleSize();                           \
   }
 #define ABSTRACT_STMT(STMT) STMT
 #include <clang/AST/StmtNodes.inc>
 
-  int tupleSizeOfStmtClass(const Stmt::StmtClass stmtClass) {
-    switch (stmtClass) {
-#define STMT(CLASS, PARENT)                                     \
-      case Stmt::CLASS##Class:                                  \
-        return static_cast<Impl*>(this)->CLASS##TupleSize();
-#define ABSTRACT_STMT(STMT)
-#include <clang/AST/StmtNodes.inc>
-    case Stmt::NoStmtClass: break;
+  static int tupleSizeOfStmtClass(const Stmt::StmtClass stmtClass) {
+    if (stmtClass == Stmt::NoStmtClass) {
+      llvm_unreachable("Stmt that isn't part of StmtNodes.inc!");
     }
-    llvm_unreachable("Stmt that isn't part of StmtNodes.inc!");
+    return TupleSizeTables<Impl>::stmtClassTupleSizes[stmtClass];
+  }
+
+};
+
+
+// The validator of the writers is enabled by the VALIDATE_* options.
+typedef ATDWriter::JsonWriter<raw_ostream, ATDWriter::StackValidator> JsonWriter;
+typedef ATDWriter::TeeWriter<raw_ostream, ATDWriter::StackValidator> TeeWriter;
+
+struct ByteRange {
+  uint64_t Offset;
+  uint64_t Length;
+};
+
+struct BodyHashEntry {
+  std::string name;
+  std::string hash;
+};
+
+/// Counters of an export, summed over the shards.
+struct ExportProfile {
+  unsigned long dumpedNodes = 0;
+  unsigned long methodLookups = 0;
+  unsigned long methodLookupCacheHits = 0;
+
+  ExportProfile &operator+=(const ExportProfile &Other) {
+    dumpedNodes += Other.dumpedNodes;
+    methodLookups += Other.methodLookups;
+    methodLookupCacheHits += Other.methodLookupCacheHits;
+    return *this;
   }
+};
+
+/// Edge of the reference graph, from the function, method or block whose
+/// body contains the call or the reference. The callee of a message send may
+/// be unknown, in which case only the selector is recorded.
+struct ReferenceGraphEdge {
+  enum Kind { Call, Reference };
+  Kind kind;
+  const Decl *from;
+  const Decl *to;
+  std::string selector;
+
+  bool operator<(const ReferenceGraphEdge &Other) const {
+    return std::tie(kind, from, to, selector)
+      < std::tie(Other.kind, Other.from, Other.to, Other.selector);
+  }
+};
 
+/// Entry of the table of declaration contexts. The parent is null for the
+/// outermost named context.
+struct DeclContextName {
+  const Decl *context;
+  std::string name;
+  const Decl *parent;
 };
 
+/// Contexts whose declarations are exported one by one, as opposed to records,
+/// Objective-C containers or functions that are exported as a whole.
+static bool isNamespaceLikeContext(const DeclContext *DC) {
+  return isa<TranslationUnitDecl>(DC) || isa<NamespaceDecl>(DC) || isa<LinkageSpecDecl>(DC);
+}
+
+/// Declarations reachable from the declarations of the main file, see
+/// EXPORT_REFERENCED_ONLY. Reachability is computed by unit, where a unit is
+/// a declaration of a namespace-like context. A unit is reachable if one of
+/// its declarations is used by a reachable unit, and all the declarations
+/// and types used in a reachable unit are followed. The result also contains
+/// the namespace-like contexts of the reachable units.
+class ReferencedDeclsCollector : public RecursiveASTVisitor<ReferencedDeclsCollector> {
+  const SourceManager &SM;
+  bool ShouldLoadDecls;
+  std::unordered_set<const Decl*> &Reachable;
+  std::vector<const Decl*> Worklist;
+  std::unordered_set<const Type*> VisitedTypes;
+
+  bool isInMainFile(const Decl *D) {
+    return SM.isInMainFile(SM.getExpansionLoc(D->getLocation()));
+  }
+
+  // Templates are exported with their implicit instantiations.
+  static const Decl *getExportedUnit(const Decl *D) {
+    if (const FunctionDecl *FD = dyn_cast<FunctionDecl>(D)) {
+      if (const FunctionTemplateDecl *T = FD->getPrimaryTemplate()) {
+        return T;
+      }
+      if (const FunctionTemplateDecl *T = FD->getDescribedFunctionTemplate()) {
+        return T;
+      }
+    } else if (const CXXRecordDecl *RD = dyn_cast<CXXRecordDecl>(D)) {
+      if (const ClassTemplateDecl *T = RD->getDescribedClassTemplate()) {
+        return T;
+      }
+      const ClassTemplateSpecializationDecl *Spec = dyn_cast<ClassTemplateSpecializationDecl>(RD);
+      if (Spec && Spec->getSpecializationKind() == TSK_ImplicitInstantiation) {
+        return Spec->getSpecializedTemplate();
+      }
+    }
+    return D;
+  }
+
+  void addUnit(const Decl *D) {
+    const DeclContext *DC = D->getLexicalDeclContext();
+    while (DC && !isNamespaceLikeContext(DC)) {
+      D = cast<Decl>(DC);
+      DC = D->getLexicalDeclContext();
+    }
+    if (!DC) {
+      return;
+    }
+    D = getExportedUnit(D);
+    if (!Reachable.insert(D).second) {
+      return;
+    }
+    Worklist.push_back(D);
+    for (DC = D->getLexicalDeclContext(); !isa<TranslationUnitDecl>(DC); DC = cast<Decl>(DC)->getLexicalDeclContext()) {
+      Reachable.insert(cast<Decl>(DC));
+    }
+  }
+
+  // Main file declarations of the namespace-like context DC, recursively.
+  void addMainFileDecls(const DeclContext *DC) {
+    for (const Decl *D : ShouldLoadDecls ? DC->decls() : DC->noload_decls()) {
+      const DeclContext *Inner = dyn_cast<DeclContext>(D);
+      if (Inner && isNamespaceLikeContext(Inner)) {
+        if (isInMainFile(D)) {
+          Reachable.insert(D);
+        }
+        addMainFileDecls(Inner);
+      } else if (isInMainFile(D)) {
+        addUnit(D);
+      }
+    }
+  }
+
+public:
+  ReferencedDeclsCollector(const SourceManager &SM, bool ShouldLoadDecls,
+                           std::unordered_set<const Decl*> &Reachable)
+    : SM(SM), ShouldLoadDecls(ShouldLoadDecls), Reachable(Reachable) {}
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+  void collect(const TranslationUnitDecl *TU) {
+    addMainFileDecls(TU);
+    while (!Worklist.empty()) {
+      const Decl *D = Worklist.back();
+      Worklist.pop_back();
+      TraverseDecl(const_cast<Decl*>(D));
+    }
+  }
+
+  void addDecl(const Decl *D) {
+    if (!D) {
+      return;
+    }
+    // e.g. out-of-line definitions of methods declared in a reachable class
+    for (const Decl *R : D->redecls()) {
+      addUnit(R);
+    }
+  }
+
+  void addType(QualType QT) {
+    const Type *T = QT.getTypePtrOrNull();
+    if (!T || !VisitedTypes.insert(T).second) {
+      return;
+    }
+    addType(T->getCanonicalTypeInternal());
+    addType(QualType(T->getLocallyUnqualifiedSingleStepDesugaredType().getTypePtr(), 0));
+    if (const TagType *TT = dyn_cast<TagType>(T)) {
+      addDecl(TT->getDecl());
+    } else if (const TypedefType *TT = dyn_cast<TypedefType>(T)) {
+      addDecl(TT->getDecl());
+    } else if (const ObjCInterfaceType *IT = dyn_cast<ObjCInterfaceType>(T)) {
+      addDecl(IT->getDecl());
+    } else if (const ObjCObjectType *OT = dyn_cast<ObjCObjectType>(T)) {
+      addType(OT->getBaseType());
+      for (const ObjCProtocolDecl *P : OT->quals()) {
+        addDecl(P);
+      }
+    } else if (const TemplateSpecializationType *TST = dyn_cast<TemplateSpecializationType>(T)) {
+      addDecl(TST->getTemplateName().getAsTemplateDecl());
+    } else if (const PointerType *PT = dyn_cast<PointerType>(T)) {
+      addType(PT->getPointeeType());
+    } else if (const BlockPointerType *BPT = dyn_cast<BlockPointerType>(T)) {
+      addType(BPT->getPointeeType());
+    } else if (const ReferenceType *RT = dyn_cast<ReferenceType>(T)) {
+      addType(RT->getPointeeType());
+    } else if (const MemberPointerType *MPT = dyn_cast<MemberPointerType>(T)) {
+      addType(MPT->getPointeeType());
+      addType(QualType(MPT->getClass(), 0));
+    } else if (const ObjCObjectPointerType *OPT = dyn_cast<ObjCObjectPointerType>(T)) {
+      addType(OPT->getPointeeType());
+    } else if (const ArrayType *AT = dyn_cast<ArrayType>(T)) {
+      addType(AT->getElementType());
+    } else if (const FunctionType *FT = dyn_cast<FunctionType>(T)) {
+      addType(FT->getReturnType());
+      if (const FunctionProtoType *FPT = dyn_cast<FunctionProtoType>(FT)) {
+        for (QualType ParamType : FPT->getParamTypes()) {
+          addType(ParamType);
+        }
+      }
+    } else if (const AtomicType *AT = dyn_cast<AtomicType>(T)) {
+      addType(AT->getValueType());
+    }
+  }
 
-typedef ATDWriter::JsonWriter<raw_ostream> JsonWriter;
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    addDecl(E->getDecl());
+    return true;
+  }
+  bool VisitMemberExpr(MemberExpr *E) {
+    addDecl(E->getMemberDecl());
+    return true;
+  }
+  bool VisitObjCMessageExpr(ObjCMessageExpr *E) {
+    addDecl(E->getMethodDecl());
+    addDecl(E->getReceiverInterface());
+    return true;
+  }
+  bool VisitObjCIvarRefExpr(ObjCIvarRefExpr *E) {
+    addDecl(E->getDecl());
+    return true;
+  }
+  bool VisitObjCPropertyRefExpr(ObjCPropertyRefExpr *E) {
+    if (E->isExplicitProperty()) {
+      addDecl(E->getExplicitProperty());
+    } else {
+      addDecl(E->getImplicitPropertyGetter());
+      addDecl(E->getImplicitPropertySetter());
+    }
+    if (E->isClassReceiver()) {
+      addDecl(E->getClassReceiver());
+    }
+    return true;
+  }
+  bool VisitObjCProtocolExpr(ObjCProtocolExpr *E) {
+    addDecl(E->getProtocol());
+    return true;
+  }
+  bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+    addDecl(E->getConstructor());
+    return true;
+  }
+  bool VisitCXXNewExpr(CXXNewExpr *E) {
+    addDecl(E->getOperatorNew());
+    addDecl(E->getOperatorDelete());
+    return true;
+  }
+  bool VisitCXXDeleteExpr(CXXDeleteExpr *E) {
+    addDecl(E->getOperatorDelete());
+    return true;
+  }
+  bool VisitExpr(Expr *E) {
+    addType(E->getType());
+    return true;
+  }
+  bool VisitValueDecl(ValueDecl *D) {
+    addType(D->getType());
+    return true;
+  }
+  bool VisitTypeDecl(TypeDecl *D) {
+    addType(QualType(D->getTypeForDecl(), 0));
+    return true;
+  }
+  bool VisitObjCMethodDecl(ObjCMethodDecl *D) {
+    addType(D->getReturnType());
+    return true;
+  }
+  bool VisitObjCInterfaceDecl(ObjCInterfaceDecl *D) {
+    if (D->hasDefinition()) {
+      addDecl(D->getSuperClass());
+      for (const ObjCProtocolDecl *P : D->protocols()) {
+        addDecl(P);
+      }
+    }
+    return true;
+  }
+  bool VisitObjCCategoryDecl(ObjCCategoryDecl *D) {
+    addDecl(D->getClassInterface());
+    for (const ObjCProtocolDecl *P : D->protocols()) {
+      addDecl(P);
+    }
+    return true;
+  }
+  bool VisitObjCImplDecl(ObjCImplDecl *D) {
+    addDecl(D->getClassInterface());
+    if (const ObjCCategoryImplDecl *CID = dyn_cast<ObjCCategoryImplDecl>(D)) {
+      addDecl(CID->getCategoryDecl());
+    }
+    return true;
+  }
+  bool VisitObjCProtocolDecl(ObjCProtocolDecl *D) {
+    if (D->hasDefinition()) {
+      for (const ObjCProtocolDecl *P : D->protocols()) {
+        addDecl(P);
+      }
+    }
+    return true;
+  }
+  bool VisitObjCPropertyDecl(ObjCPropertyDecl *D) {
+    addType(D->getType());
+    return true;
+  }
+  bool VisitTypeLoc(TypeLoc TL) {
+    addType(TL.getType());
+    return true;
+  }
+};
 
 template <class ATDWriter = JsonWriter>
 class ASTExporter :
@@ -129,8 +668,10 @@ class ASTExporter :
 {
   typedef typename ATDWriter::ObjectScope ObjectScope;
   typedef typename ATDWriter::ArrayScope ArrayScope;
+  typedef typename ATDWriter::TableScope TableScope;
   typedef typename ATDWriter::TupleScope TupleScope;
   typedef typename ATDWriter::VariantScope VariantScope;
+  raw_ostream &OS;
   ATDWriter OF;
 
   const ASTExporterOptions &Options;
@@ -157,30 +698,180 @@ class ASTExporter :
 
   std::vector<const Type*> types;
 
+  /// Memory for the strings and vectors that only live while a node is
+  /// being dumped. The arena is reset after each top-level declaration. The
+  /// list of top-level declarations lives in TopLevelArena instead.
+  llvm::BumpPtrAllocator Arena;
+  llvm::BumpPtrAllocator TopLevelArena;
+  const PrintingPolicy TypePrintingPolicy;
+
+  /// Byte ranges of the top-level declarations and of the type table in OS,
+  /// only recorded when a declaration index was requested.
+  std::vector<std::pair<const Decl*, ByteRange>> declIndex;
+  ByteRange typesRange;
+
+  /// Only the top-level declarations assigned to this shard are dumped.
+  /// The type table is dumped in shard 0.
+  const unsigned Shard;
+  const unsigned NumShards;
+  unsigned NumTopLevelDecls;
+
+  /// Structural sharing of qual_type and decl_ref records. Sharing is
+  /// disabled when a declaration index is requested because the byte ranges
+  /// of the index would no longer be self-contained.
+  const bool ShareRecords;
+  typedef std::unordered_map<const void*, unsigned> SharedRecordTable;
+  SharedRecordTable SharedQualTypes;
+  SharedRecordTable SharedDeclRefs;
+  unsigned NextSharedId;
+
+  /// Implicit instantiations of templates already dumped in full.
+  std::unordered_set<const Decl*> DumpedSpecializations;
+
+  /// Body hashes, recorded when a manifest was requested. The mangler
+  /// names the entries of the manifest.
+  std::vector<BodyHashEntry> BodyHashes;
+  std::unique_ptr<MangleContext> Mangler;
+
+  /// Reference graph, recorded when requested. BodyOwner is the function,
+  /// method or block whose body is being dumped.
+  const bool ShouldRecordReferenceGraph;
+  std::vector<ReferenceGraphEdge> ReferenceGraph;
+  std::set<ReferenceGraphEdge> ReferenceGraphEdges;
+  const Decl *BodyOwner;
+
+  /// Methods called by message sends, memoized by receiver interface and
+  /// selector, for class methods (0) and instance methods (1). Lookups walk
+  /// the categories, protocols and superclasses of the receiver, and the same
+  /// few selectors are sent to the same classes over and over.
+  struct ResolvedMethod {
+    const ObjCMethodDecl *Decl;
+    bool IsDefinitionFound;
+  };
+  llvm::DenseMap<std::pair<const ObjCInterfaceDecl*, Selector>, ResolvedMethod> MethodLookups[2];
+  ExportProfile Profile;
+
+  /// Comments parsed so far, memoized by raw comment. The instantiations of
+  /// a template are attached to the raw comment of their pattern.
+  llvm::DenseMap<const RawComment*, const FullComment*> ParsedComments;
+
+  /// Declaration contexts named so far, recorded when a table of contexts
+  /// was requested. Children come before their parents.
+  const bool ShouldNameDeclContexts;
+  std::vector<DeclContextName> DeclContextNames;
+  std::unordered_set<const Decl*> NamedDeclContexts;
+
+  /// Declarations reachable from the main file, when only those are exported.
+  const bool ShouldExportReferencedOnly;
+  std::unordered_set<const Decl*> ReferencedDecls;
+  /// Types referred to by the output, in order of first reference, when the
+  /// type table only lists those. The list grows while the table is dumped.
+  const bool ShouldListReferencedTypes;
+  std::vector<const Type*> ReferencedTypes;
+  std::unordered_set<const Type*> ReferencedTypeSet;
+
+  /// Wrappers collapsed by dumpStmt into the expression being dumped,
+  /// outermost first. They are consumed by VisitExpr.
+  typedef SmallVector<const Expr*, 4> ExprWrappers;
+  const ExprWrappers *CollapsedWrappers;
+
+  /// Resource budgets. Once a budget is exhausted, every declaration or
+  /// statement that remains to be dumped is replaced by a truncation marker.
+  enum TruncationReason {
+    NotTruncated,
+    MaxNodesReached,
+    MaxOutputBytesReached,
+    MaxExportSecondsReached,
+    MaxBodyNodesReached,
+  };
+  unsigned long NumDumpedNodes;
+  uint64_t StartOffset;
+  std::chrono::steady_clock::time_point StartTime;
+  TruncationReason ExhaustedBudget;
+
+  /// Emits a reference if the record for Key was already emitted, otherwise
+  /// wraps the record in a shared value for the lifetime of the scope.
+  class SharedRecordScope {
+    ATDWriter &OF;
+    bool IsEntered;
+    bool IsReference;
+  public:
+    SharedRecordScope(ASTExporter &E, SharedRecordTable &Table, const void *Key)
+      : OF(E.OF), IsEntered(false), IsReference(false) {
+      if (!E.ShareRecords) {
+        return;
+      }
+      auto I = Table.find(Key);
+      if (I != Table.end()) {
+        OF.emitSharedRef(I->second);
+        IsReference = true;
+      } else {
+        unsigned Id = E.NextSharedId++;
+        Table[Key] = Id;
+        OF.enterShared(Id);
+        IsEntered = true;
+      }
+    }
+    ~SharedRecordScope() {
+      if (IsEntered) {
+        OF.leaveShared();
+      }
+    }
+    bool isReference() const { return IsReference; }
+  };
+
 public:
-  ASTExporter(raw_ostream &OS, ASTContext &Context, const ASTExporterOptions &Opts)
-    : OF(OS, Opts.atdWriterOptions),
+  ASTExporter(raw_ostream &OS, ASTContext &Context, const ASTExporterOptions &Opts,
+              unsigned Shard = 0, unsigned NumShards = 1)
+    : OS(OS),
+      OF(OS, Opts.astWriterOptions()),
       Options(Opts),
       Traits(Context.getCommentCommandTraits()),
       SM(Context.getSourceManager()),
       NullPtrStmt(new (Context) NullStmt(SourceLocation())),
       NullPtrDecl(EmptyDecl::Create(Context, Context.getTranslationUnitDecl(), SourceLocation())),
       NullPtrComment(new (Context) Comment(Comment::NoCommentKind, SourceLocation(), SourceLocation())),
-      LastLocFilename(""), LastLocLine(~0U), FC(0)
+      LastLocFilename(""), LastLocLine(~0U), FC(0),
+      TypePrintingPolicy(LangOptions()), typesRange(),
+      Shard(Shard), NumShards(NumShards), NumTopLevelDecls(0),
+      ShareRecords(Opts.shareRecords && Opts.declIndexFile == ""),
+      NextSharedId(0),
+      ShouldRecordReferenceGraph(Opts.referenceGraphFile != ""), BodyOwner(nullptr),
+      ShouldNameDeclContexts(Opts.declContextsFile != ""),
+      ShouldExportReferencedOnly(Opts.exportReferencedOnly),
+      ShouldListReferencedTypes(Opts.exportReferencedOnly || Opts.deterministic),
+      CollapsedWrappers(nullptr),
+      NumDumpedNodes(0), StartOffset(OS.tell()),
+      StartTime(std::chrono::steady_clock::now()), ExhaustedBudget(NotTruncated)
   {
-    /* this should work because ASTContext will hold on to these for longer */
-    for (const Type* t : Context.getTypes()) {
-      types.push_back(t);
+    OF.validator().setEnabled(Opts.shouldValidateOutput());
+    OF.validator().setMaxValues(Opts.validateMaxNodes);
+    if (Opts.compactFieldIds) {
+      dumpFieldIdsHeader();
+      StartOffset = OS.tell();
+    }
+    if (ShouldExportReferencedOnly) {
+      ReferencedDeclsCollector Collector(SM, !Opts.referenceImportedDecls, ReferencedDecls);
+      Collector.collect(Context.getTranslationUnitDecl());
+    }
+    if (!ShouldListReferencedTypes) {
+      /* this should work because ASTContext will hold on to these for longer */
+      for (const Type* t : Context.getTypes()) {
+        types.push_back(t);
+      }
     }
     // Just in case, add NoneType to dumped types
     types.push_back(nullptr);
   }
 
   void dumpDecl(const Decl *D);
+  void dumpDeclSelection(ASTContext &Context, const std::vector<const Decl*> &Decls);
+  void dumpTypeTable(const ASTContext &Context, bool ShouldDumpTypes);
   void dumpStmt(const Stmt *S);
   void dumpFullComment(const FullComment *C);
   void dumpType(const Type *T);
   void dumpPointerToType(const QualType &qt);
+  void noteReferencedType(const Type *T);
 
   // Utilities
   void dumpPointer(const void *Ptr);
@@ -194,6 +885,40 @@ public:
   void dumpAttr(const Attr &A);
   void dumpSelector(const Selector sel);
   void dumpName(const NamedDecl& decl);
+  void recordDeclContextName(const NamedDecl *D);
+  void emitString(StringRef Str) { OF.emitString(Str.data(), Str.size()); }
+  StringRef printType(SplitQualType T);
+  StringRef printSelector(Selector Sel);
+  void dumpDeclIndex(raw_ostream &IndexOS);
+  void dumpFieldIdsHeader();
+  unsigned shardOfDecl(const Decl &D);
+  unsigned getNumTopLevelDecls() const { return NumTopLevelDecls; }
+  ATDWriter &getWriter() { return OF; }
+  const std::vector<BodyHashEntry> &getBodyHashes() const { return BodyHashes; }
+  const std::vector<ReferenceGraphEdge> &getReferenceGraph() const { return ReferenceGraph; }
+  const std::vector<DeclContextName> &getDeclContextNames() const { return DeclContextNames; }
+  ExportProfile getProfile() const {
+    ExportProfile Result = Profile;
+    Result.dumpedNodes = NumDumpedNodes;
+    return Result;
+  }
+  ResolvedMethod resolveMethod(const ObjCInterfaceDecl &Receiver, Selector Sel, bool IsInst);
+  void recordReferenceGraphEdge(ReferenceGraphEdge::Kind Kind, const Decl *To,
+                                const std::string &Selector = "");
+  bool shouldDumpBodyHash(const Stmt *Body) const { return Options.bodyHashes && Body; }
+  void dumpBodyHash(const Decl &D, const Stmt *Body);
+  std::string getMangledName(const Decl &D);
+  TruncationReason consumeNodeBudget();
+  void dumpTruncation(const std::string &Kind, TruncationReason Reason);
+  void dumpTruncatedDecl(const Decl &D, TruncationReason Reason);
+  void dumpStubDeclFields(const Decl &D);
+  void dumpImportedDecl(const Decl &D);
+  void dumpImportedDeclInfo(const Decl &D);
+  std::string getDeclKey(const Decl &D);
+  void dumpTruncatedStmt(const Stmt &S, TruncationReason Reason);
+  void dumpBody(const Decl &Owner, const Stmt *Body);
+  void dumpBodyStmt(const Stmt *Body);
+  const FullComment *getLocalComment(const Decl *D);
 
 
   // C++ Utilities
@@ -204,13 +929,19 @@ public:
 //    void dumpTemplateParameters(const TemplateParameterList *TPL);
 //    void dumpTemplateArgumentListInfo(const TemplateArgumentListInfo &TALI);
 //    void dumpTemplateArgumentLoc(const TemplateArgumentLoc &A);
-//    void dumpTemplateArgumentList(const TemplateArgumentList &TAL);
-//    void dumpTemplateArgument(const TemplateArgument &A,
-//                              SourceRange R = SourceRange());
+  void dumpTemplateArgumentList(const TemplateArgumentList &TAL);
+  void dumpTemplateArgument(const TemplateArgument &A);
+  void dumpTemplateSpecializationInfo(const Decl &Template,
+                                      TemplateSpecializationKind Kind,
+                                      const TemplateArgumentList &Args);
+  template <class TemplateDeclT>
+  void dumpTemplateDeclInfo(const TemplateDeclT *D, bool DumpExplicitInstantiations);
   void dumpCXXBaseSpecifier(const CXXBaseSpecifier &Base);
+  void dumpValueKind(ExprValueKind VK);
+  void dumpCollapsedWrapper(const Expr &Wrapper);
 
 #define DECLARE_VISITOR(NAME) \
-  int NAME##TupleSize(); \
+  static constexpr int NAME##TupleSize(); \
   void Visit##NAME(const NAME *D);
 
   // Decls
@@ -249,10 +980,9 @@ public:
 //                                         const SpecializationDecl *D,
 //                                         bool DumpExplicitInst,
 //                                         bool DumpRefOnly);
-//    void VisitFunctionTemplateDecl(const FunctionTemplateDecl *D);
-//    void VisitClassTemplateDecl(const ClassTemplateDecl *D);
-//    void VisitClassTemplateSpecializationDecl(
-//        const ClassTemplateSpecializationDecl *D);
+  DECLARE_VISITOR(FunctionTemplateDecl)
+  DECLARE_VISITOR(ClassTemplateDecl)
+  DECLARE_VISITOR(ClassTemplateSpecializationDecl)
 //    void VisitClassTemplatePartialSpecializationDecl(
 //        const ClassTemplatePartialSpecializationDecl *D);
 //    void VisitClassScopeFunctionSpecializationDecl(
@@ -295,6 +1025,7 @@ public:
 
   // Exprs
   DECLARE_VISITOR(Expr)
+  void VisitCallExpr(const CallExpr *Node);
   DECLARE_VISITOR(CastExpr)
   DECLARE_VISITOR(ExplicitCastExpr)
   DECLARE_VISITOR(DeclRefExpr)
@@ -482,7 +1213,7 @@ void ASTExporter<ATDWriter>::dumpTypeOld(const Type *T) {
     OF.emitSimpleVariant("NoType");
   } else {
     VariantScope Scope(OF, "Type");
-    OF.emitString(QualType::getAsString(QualType(T, 0).getSplitDesugaredType()));
+    emitString(printType(QualType(T, 0).getSplitDesugaredType()));
   }
 }
 
@@ -494,6 +1225,10 @@ void ASTExporter<ATDWriter>::dumpTypeOld(const Type *T) {
 /// } <ocaml field_prefix="qt_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpQualType(QualType T) {
+  SharedRecordScope Shared(*this, SharedQualTypes, T.getAsOpaquePtr());
+  if (Shared.isReference()) {
+    return;
+  }
   // TODO - clean it up - remove raw and desugared info type_ptr has this information already
   bool ShouldEmitDesugared = false;
   SplitQualType T_split = T.split();
@@ -501,51 +1236,172 @@ void ASTExporter<ATDWriter>::dumpQualType(QualType T) {
     // If the type is sugared, also dump a (shallow) desugared type.
     ShouldEmitDesugared = true;
   }
-  ObjectScope Scope(OF, 2 + ShouldEmitDesugared);
+  RecordFields<atd::qual_type> Fields;
+  Fields.set(atd::qual_type::desugared, ShouldEmitDesugared);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("raw");
-  OF.emitString(QualType::getAsString(T_split));
+  emitString(printType(T_split));
   if (ShouldEmitDesugared) {
     OF.emitTag("desugared");
-    OF.emitString(QualType::getAsString(T.getSplitDesugaredType()));
+    emitString(printType(T.getSplitDesugaredType()));
   }
   OF.emitTag("type_ptr");
   dumpPointerToType(T);
 }
 
+/// With DECL_CONTEXTS_FILE, the qualified name is replaced by the innermost
+/// named context of the declaration, if any. The qualified name is the one of
+/// the context followed by the name of the declaration.
 /// \atd
 /// type named_decl_info = {
 ///   name : string;
-///   qual_name : string list
+///   ~qual_name : string list;
+///   ?context : pointer option;
 /// } <ocaml field_prefix="ni_">
+static ArenaVector<StringRef> splitQualifiedName(const NamedDecl& decl, llvm::BumpPtrAllocator &Arena) {
+  ArenaStringOStream qualName(Arena);
+  decl.printQualifiedName(qualName);
+  // split name with ::
+  ArenaVector<StringRef> splitted(Arena);
+  StringRef rest = qualName.str();
+  size_t pos;
+  while ((pos = rest.find("::")) != StringRef::npos) {
+    splitted.push_back(rest.substr(0, pos));
+    rest = rest.substr(pos + 2);
+  }
+  splitted.push_back(rest);
+  return splitted;
+}
+
+/// Innermost context starting from Ctx that NamedDecl::printQualifiedName
+/// prints as a component of qualified names. Anonymous unscoped enums are
+/// skipped and unnamed contexts such as linkage specifications end the chain.
+static const NamedDecl *getNamedDeclContext(const DeclContext *Ctx) {
+  for (; Ctx && isa<NamedDecl>(Ctx); Ctx = Ctx->getParent()) {
+    const EnumDecl *ED = dyn_cast<EnumDecl>(Ctx);
+    if (!ED || ED->isScoped() || ED->getIdentifier()) {
+      return cast<NamedDecl>(Ctx);
+    }
+  }
+  return nullptr;
+}
+
+/// Same as the component printed for D by NamedDecl::printQualifiedName when
+/// D is a context of the printed declaration. Clang prints these components
+/// in the loop of printQualifiedName only, while printQualifiedName(D) ends
+/// with D->printName, which leaves out the template arguments of
+/// specializations and the parameters of functions. Hence the cases of that
+/// loop (lib/AST/Decl.cpp) are copied here, and must follow clang upgrades.
+static void printDeclContextName(const NamedDecl &D, raw_ostream &OS) {
+  const PrintingPolicy &P = D.getASTContext().getPrintingPolicy();
+  if (const ClassTemplateSpecializationDecl *Spec = dyn_cast<ClassTemplateSpecializationDecl>(&D)) {
+    OS << Spec->getName();
+    const TemplateArgumentList &TemplateArgs = Spec->getTemplateArgs();
+    TemplateSpecializationType::PrintTemplateArgumentList(OS, TemplateArgs.data(), TemplateArgs.size(), P);
+  } else if (const NamespaceDecl *ND = dyn_cast<NamespaceDecl>(&D)) {
+    if (ND->isAnonymousNamespace()) {
+      OS << "(anonymous namespace)";
+    } else {
+      OS << *ND;
+    }
+  } else if (const RecordDecl *RD = dyn_cast<RecordDecl>(&D)) {
+    if (!RD->getIdentifier()) {
+      OS << "(anonymous " << RD->getKindName() << ')';
+    } else {
+      OS << *RD;
+    }
+  } else if (const FunctionDecl *FD = dyn_cast<FunctionDecl>(&D)) {
+    const FunctionProtoType *FT = nullptr;
+    if (FD->hasWrittenPrototype()) {
+      FT = dyn_cast<FunctionProtoType>(FD->getType()->castAs<FunctionType>());
+    }
+    OS << *FD << '(';
+    if (FT) {
+      unsigned NumParams = FD->getNumParams();
+      for (unsigned i = 0; i < NumParams; ++i) {
+        if (i) {
+          OS << ", ";
+        }
+        OS << FD->getParamDecl(i)->getType().stream(P);
+      }
+      if (FT->isVariadic()) {
+        if (NumParams > 0) {
+          OS << ", ";
+        }
+        OS << "...";
+      }
+    }
+    OS << ')';
+  } else {
+    OS << D;
+  }
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::recordDeclContextName(const NamedDecl *D) {
+  while (D && NamedDeclContexts.insert(D).second) {
+    const NamedDecl *Parent = getNamedDeclContext(cast<DeclContext>(D)->getParent());
+    DeclContextName Entry = {D, "", Parent};
+    llvm::raw_string_ostream Name(Entry.name);
+    printDeclContextName(*D, Name);
+    Name.flush();
+    DeclContextNames.push_back(std::move(Entry));
+    D = Parent;
+  }
+}
+
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpName(const NamedDecl& decl) {
+  // Local declarations are not qualified, see NamedDecl::printQualifiedName.
+  const NamedDecl *Context = nullptr;
+  if (ShouldNameDeclContexts && !decl.getDeclContext()->isFunctionOrMethod()) {
+    Context = getNamedDeclContext(decl.getDeclContext());
+    recordDeclContextName(Context);
+  }
+  RecordFields<atd::named_decl_info> Fields;
+  Fields.set(atd::named_decl_info::qual_name, !ShouldNameDeclContexts)
+        .set(atd::named_decl_info::context, Context);
+  ObjectScope oScope(OF, Fields);
+
   // dump name
-  ObjectScope oScope(OF, 2);
   OF.emitTag("name");
-  OF.emitString(decl.getNameAsString());
-  OF.emitTag("qual_name");
-  {
-    std::string qualName = decl.getQualifiedNameAsString();
-    // split name with :: and reverse the list
-    std::vector<std::string> splitted;
-    std::string token = "::";
-    std::string::size_type firstChar = 0;
-    std::string::size_type lastChar = qualName.find(token, firstChar);
-    while (lastChar != std::string::npos) {
-
-      splitted.push_back(qualName.substr(firstChar, lastChar - firstChar));
-      firstChar = lastChar + token.length();
-      lastChar = qualName.find(token, firstChar);
-    }
-    splitted.push_back(qualName.substr(firstChar));
+  if (const IdentifierInfo *II = decl.getIdentifier()) {
+    emitString(II->getName());
+  } else {
+    ArenaStringOStream name(Arena);
+    name << decl.getDeclName();
+    emitString(name.str());
+  }
+  if (!ShouldNameDeclContexts) {
+    OF.emitTag("qual_name");
+    ArenaVector<StringRef> splitted = splitQualifiedName(decl, Arena);
 
     ArrayScope aScope(OF, splitted.size());
     // dump list in reverse
     for (int i = splitted.size() - 1; i >= 0; i--) {
-      OF.emitString(splitted[i]);
+      emitString(splitted[i]);
     }
   }
+  if (Context) {
+    OF.emitTag("context");
+    dumpPointer(Context);
+  }
+}
+
+/// Same as QualType::getAsString, printed in the arena.
+template <class ATDWriter>
+StringRef ASTExporter<ATDWriter>::printType(SplitQualType T) {
+  ArenaStringOStream Str(Arena);
+  QualType::print(T.Ty, T.Quals, Str, TypePrintingPolicy, Twine());
+  return Str.str();
+}
+
+template <class ATDWriter>
+StringRef ASTExporter<ATDWriter>::printSelector(Selector Sel) {
+  ArenaStringOStream Str(Arena);
+  Sel.print(Str);
+  return Str.str();
 }
 
 /// \atd
@@ -554,7 +1410,8 @@ void ASTExporter<ATDWriter>::dumpName(const NamedDecl& decl) {
 ///   decl_pointer : pointer;
 ///   ?name : named_decl_info option;
 ///   ~is_hidden : bool;
-///   ?qual_type : qual_type option
+///   ?qual_type : qual_type option;
+///   ?imported_decl : imported_decl option
 /// } <ocaml field_prefix="dr_">
 ///
 /// type decl_kind = [
@@ -564,10 +1421,20 @@ void ASTExporter<ATDWriter>::dumpName(const NamedDecl& decl) {
 /// ]
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpDeclRef(const Decl &D) {
+  SharedRecordScope Shared(*this, SharedDeclRefs, &D);
+  if (Shared.isReference()) {
+    return;
+  }
   const NamedDecl *ND = dyn_cast<NamedDecl>(&D);
   const ValueDecl *VD = dyn_cast<ValueDecl>(&D);
   bool IsHidden = ND && ND->isHidden();
-  ObjectScope Scope(OF, 2 + (bool) ND + (bool) VD + IsHidden);
+  bool IsImported = Options.referenceImportedDecls && D.isFromASTFile();
+  RecordFields<atd::decl_ref> Fields;
+  Fields.set(atd::decl_ref::name, ND)
+        .set(atd::decl_ref::is_hidden, IsHidden)
+        .set(atd::decl_ref::qual_type, VD)
+        .set(atd::decl_ref::imported_decl, IsImported);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("kind");
   OF.emitSimpleVariant(D.getDeclKindName());
@@ -582,10 +1449,14 @@ void ASTExporter<ATDWriter>::dumpDeclRef(const Decl &D) {
     OF.emitTag("qual_type");
     dumpQualType(VD->getType());
   }
+  if (IsImported) {
+    OF.emitTag("imported_decl");
+    dumpImportedDeclInfo(D);
+  }
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::DeclContextTupleSize() { return 2; }
+constexpr int ASTExporter<ATDWriter>::DeclContextTupleSize() { return 2; }
 /// \atd
 /// #define decl_context_tuple decl list * decl_context_info
 /// type decl_context_info = {
@@ -600,8 +1471,19 @@ void ASTExporter<ATDWriter>::VisitDeclContext(const DeclContext *DC) {
     return;
   }
   {
-    std::vector<Decl*> declsToDump;
-    for (auto I : DC->decls()) {
+    bool IsTopLevel = isa<TranslationUnitDecl>(DC);
+    // Iterating over decls() would deserialize the whole external lexical
+    // storage of DC. When imported declarations are dumped as references,
+    // only the declarations already loaded are visited.
+    bool ShouldReferenceImportedDecls = Options.referenceImportedDecls;
+    ArenaVector<Decl*> declsToDump(IsTopLevel ? TopLevelArena : Arena);
+    for (auto I : ShouldReferenceImportedDecls ? DC->noload_decls() : DC->decls()) {
+      if (IsTopLevel && NumShards > 1 && shardOfDecl(*I) != Shard) {
+        continue;
+      }
+      if (ShouldExportReferencedOnly && isNamespaceLikeContext(DC) && !ReferencedDecls.count(I)) {
+        continue;
+      }
       if (Options.deduplicationService == nullptr
           || FileUtils::shouldTraverseDeclFile(*Options.deduplicationService,
                                                Options.basePath,
@@ -610,15 +1492,35 @@ void ASTExporter<ATDWriter>::VisitDeclContext(const DeclContext *DC) {
         declsToDump.push_back(I);
       }
     }
+    // Top-level declarations are indexed by their byte range in the output.
+    // Note that a range includes the separator that precedes the declaration.
+    bool ShouldIndexDecls = Options.declIndexFile != "" && IsTopLevel;
+    if (IsTopLevel) {
+      NumTopLevelDecls = declsToDump.size();
+    }
     ArrayScope Scope(OF, declsToDump.size());
     for (auto I : declsToDump) {
-      dumpDecl(I);
+      uint64_t Offset = OS.tell();
+      if (ShouldReferenceImportedDecls && I->isFromASTFile()) {
+        dumpImportedDecl(*I);
+      } else {
+        dumpDecl(I);
+      }
+      if (ShouldIndexDecls) {
+        declIndex.push_back(std::make_pair(I, ByteRange{Offset, OS.tell() - Offset}));
+      }
+      if (IsTopLevel) {
+        Arena.Reset();
+      }
     }
   }
   {
     bool HasExternalLexicalStorage = DC->hasExternalLexicalStorage();
     bool HasExternalVisibleStorage = DC->hasExternalVisibleStorage();
-    ObjectScope Scope(OF, 0 + HasExternalLexicalStorage + HasExternalVisibleStorage); // not covered by tests
+    RecordFields<atd::decl_context_info> Fields;
+    Fields.set(atd::decl_context_info::has_external_lexical_storage, HasExternalLexicalStorage)
+          .set(atd::decl_context_info::has_external_visible_storage, HasExternalVisibleStorage);
+    ObjectScope Scope(OF, Fields); // not covered by tests
 
     OF.emitFlag("has_external_lexical_storage", HasExternalLexicalStorage);
     OF.emitFlag("has_external_visible_storage", HasExternalVisibleStorage);
@@ -639,12 +1541,16 @@ void ASTExporter<ATDWriter>::VisitDeclContext(const DeclContext *DC) {
 /// } <ocaml field_prefix="lup_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpLookups(const DeclContext &DC) {
-  ObjectScope Scope(OF, 4); // not covered by tests
+  const DeclContext *Primary = DC.getPrimaryContext();
+  bool HasUndeserializedLookups = Primary->hasExternalVisibleStorage();
+  RecordFields<atd::lookups> Fields;
+  Fields.set(atd::lookups::primary_context_pointer, Primary != &DC)
+        .set(atd::lookups::has_undeserialized_decls, HasUndeserializedLookups);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("decl_ref");
   dumpDeclRef(cast<Decl>(DC));
 
-  const DeclContext *Primary = DC.getPrimaryContext();
   if (Primary != &DC) {
     OF.emitTag("primary_context_pointer");
     dumpPointer(cast<Decl>(Primary));
@@ -661,7 +1567,11 @@ void ASTExporter<ATDWriter>::dumpLookups(const DeclContext &DC) {
 
       ObjectScope Scope(OF, 2); // not covered by tests
       OF.emitTag("decl_name");
-      OF.emitString(Name.getAsString());
+      {
+        ArenaStringOStream Str(Arena);
+        Str << Name;
+        emitString(Str.str());
+      }
 
       OF.emitTag("decl_refs");
       {
@@ -674,10 +1584,26 @@ void ASTExporter<ATDWriter>::dumpLookups(const DeclContext &DC) {
     }
   }
 
-  bool HasUndeserializedLookups = Primary->hasExternalVisibleStorage();
   OF.emitFlag("has_undeserialized_decls", HasUndeserializedLookups);
 }
 
+/// Run the dumping code generated by clang for the parameters of A on OS.
+/// Three types of parameters are skipped (see #define's below) and output
+/// as Unknown.
+template <class Stream>
+static void dumpAttrParameters(Stream &OS, const Attr *A) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-variable"
+#define dumpBareDeclRef(X) OS.emitUnknown()
+#define dumpStmt(X) OS.emitUnknown()
+#define dumpType(X) OS.emitUnknown()
+#include <clang/AST/AttrDump.inc>
+#undef dumpBareDeclRef
+#undef dumpStmt
+#undef dumpType
+#pragma clang diagnostic pop
+}
+
 /// \atd
 /// type attribute = [
 #define ATTR(X) ///   | X@@Attr of attribute_info
@@ -686,10 +1612,23 @@ void ASTExporter<ATDWriter>::dumpLookups(const DeclContext &DC) {
 /// type attribute_info = {
 ///   pointer : pointer;
 ///   source_range : source_range;
-///   parameters : string list;
+///   parameters : attribute_parameter list;
 ///   ~is_inherited : bool;
 ///   ~is_implicit : bool
 /// } <ocaml field_prefix="ai_">
+///
+/// type attribute_parameter = [
+///   String of string
+/// | Integer of int
+/// | Version of version_tuple
+/// | Unknown
+/// ]
+///
+/// type version_tuple = {
+///   major : int;
+///   ?minor : int option;
+///   ?subminor : int option
+/// } <ocaml field_prefix="vt_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpAttr(const Attr &Att) {
   std::string tag;
@@ -702,7 +1641,10 @@ void ASTExporter<ATDWriter>::dumpAttr(const Attr &Att) {
   {
     bool IsInherited = Att.isInherited();
     bool IsImplicit = Att.isImplicit();
-    ObjectScope Scope(OF, 3 + IsInherited + IsImplicit);
+    RecordFields<atd::attribute_info> Fields;
+    Fields.set(atd::attribute_info::is_inherited, IsInherited)
+          .set(atd::attribute_info::is_implicit, IsImplicit);
+    ObjectScope Scope(OF, Fields);
     OF.emitTag("pointer");
     dumpPointer(&Att);
     OF.emitTag("source_range");
@@ -710,30 +1652,13 @@ void ASTExporter<ATDWriter>::dumpAttr(const Attr &Att) {
 
     OF.emitTag("parameters");
     {
-      AttrParameterVectorStream OS{};
-
-      // TODO: better dumping of attribute parameters.
-      // Here we skip three types of parameters (see #define's below)
-      // and output the others as strings, so clients reading the
-      // emitted AST will have to parse them.
-      const Attr *A = &Att;
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-variable"
-#define dumpBareDeclRef(X) OS << "?"
-#define dumpStmt(X) OS << "?"
-#define dumpType(X) OS << "?"
-#include <clang/AST/AttrDump.inc>
-#undef dumpBareDeclRef
-#undef dumpStmt
-#undef dumpType
-#pragma clang diagnostic pop
-
-      {
-        ArrayScope Scope(OF, OS.getContent().size());
-        for (const std::string& item : OS.getContent()) {
-          OF.emitString(item);
-        }
-      }
+      // The parameters are streamed twice: once to size the array, and once
+      // to write them.
+      AttrParameterCounter Counter;
+      dumpAttrParameters(Counter, &Att);
+      ArrayScope Scope(OF, Counter.getCount());
+      AttrParameterEmitter<ATDWriter> Emitter(OF);
+      dumpAttrParameters(Emitter, &Att);
     }
 
     OF.emitFlag("is_inherited", IsInherited);
@@ -821,7 +1746,9 @@ void ASTExporter<ATDWriter>::dumpAccessSpecifier(AccessSpecifier AS) {
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpCXXCtorInitializer(const CXXCtorInitializer &Init) {
   const Expr *E = Init.getInit();
-  ObjectScope Scope(OF, 1 + (bool) E);
+  RecordFields<atd::cxx_ctor_initializer> Fields;
+  Fields.set(atd::cxx_ctor_initializer::init_expr, E);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("subject");
   const FieldDecl *FD = Init.getAnyMember();
@@ -899,7 +1826,9 @@ void ASTExporter<ATDWriter>::dumpDeclarationName(const DeclarationName &Name) {
       break;
   }
   OF.emitTag("name");
-  OF.emitString(Name.getAsString());
+  ArenaStringOStream Str(Arena);
+  Str << Name;
+  emitString(Str.str());
 }
 /// \atd
 /// type nested_name_specifier_loc = {
@@ -926,7 +1855,10 @@ void ASTExporter<ATDWriter>::dumpNestedNameSpecifierLoc(NestedNameSpecifierLoc N
   while(!NestedNames.empty()) {
     NNS = NestedNames.pop_back_val();
     NestedNameSpecifier::SpecifierKind Kind = NNS.getNestedNameSpecifier()->getKind();
-    ObjectScope Scope(OF, 2);
+    RecordFields<atd::nested_name_specifier_loc> Fields;
+    Fields.set(atd::nested_name_specifier_loc::ref,
+               Kind == NestedNameSpecifier::Namespace || Kind == NestedNameSpecifier::NamespaceAlias);
+    ObjectScope Scope(OF, Fields);
     OF.emitTag("kind");
     switch (Kind) {
       case NestedNameSpecifier::Identifier:
@@ -968,89 +1900,152 @@ void ASTExporter<ATDWriter>::dumpNestedNameSpecifierLoc(NestedNameSpecifierLoc N
 //    dumpDecl(*I);
 //}
 //
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::dumpTemplateArgumentListInfo(
-//    const TemplateArgumentListInfo &TALI) {
-//  for (unsigned i = 0, e = TALI.size(); i < e; ++i) {
-//    dumpTemplateArgumentLoc(TALI[i]);
-//  }
-//}
-//
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::dumpTemplateArgumentLoc(const TemplateArgumentLoc &A) {
-//  dumpTemplateArgument(A.getArgument(), A.getSourceRange());
-//}
-//
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::dumpTemplateArgumentList(const TemplateArgumentList &TAL) {
-//  for (unsigned i = 0, e = TAL.size(); i < e; ++i)
-//    dumpTemplateArgument(TAL[i]);
-//}
-//
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::dumpTemplateArgument(const TemplateArgument &A, SourceRange R) {
-//  ObjectScope Scope(OF);
-//  OS << "TemplateArgument";
-//  if (R.isValid())
-//    dumpSourceRange(R);
-//
-//  switch (A.getKind()) {
-//  case TemplateArgument::Null:
-//    OS << " null";
-//    break;
-//  case TemplateArgument::Type:
-//    OS << " type";
-//    dumpQualType(A.getAsType());
-//    break;
-//  case TemplateArgument::Declaration:
-//    OS << " decl";
-//    dumpDeclRef(A.getAsDecl());
-//    break;
-//  case TemplateArgument::NullPtr:
-//    OS << " nullptr";
-//    break;
-//  case TemplateArgument::Integral:
-//    OS << " integral " << A.getAsIntegral();
-//    break;
-//  case TemplateArgument::Template:
-//    OS << " template ";
-//    // FIXME: do not use the local dump method
-//    A.getAsTemplate().dump(OS);
-//    break;
-//  case TemplateArgument::TemplateExpansion:
-//    OS << " template expansion";
-//    // FIXME: do not use the local dump method
-//    A.getAsTemplateOrTemplatePattern().dump(OS);
-//    break;
-//  case TemplateArgument::Expression:
-//    OS << " expr";
-//    dumpStmt(A.getAsExpr());
-//    break;
-//  case TemplateArgument::Pack:
-//    OS << " pack";
-//    for (TemplateArgument::pack_iterator I = A.pack_begin(), E = A.pack_end();
-//         I != E; ++I) {
-//      dumpTemplateArgument(*I);
-//    }
-//    break;
-//  }
-//}
-
-//===----------------------------------------------------------------------===//
-//  Decl dumping methods.
-//===----------------------------------------------------------------------===//
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTemplateArgumentList(const TemplateArgumentList &TAL) {
+  ArrayScope Scope(OF, TAL.size());
+  for (unsigned i = 0, e = TAL.size(); i < e; ++i) {
+    dumpTemplateArgument(TAL[i]);
+  }
+}
 
 /// \atd
-#define DECL(DERIVED, BASE) /// #define @DERIVED@_decl_tuple @BASE@_tuple
-#define ABSTRACT_DECL(DECL) DECL
-#include <clang/AST/DeclNodes.inc>
-///
+/// type template_argument = [
+///   Null
+/// | Type of qual_type
+/// | Declaration of pointer
+/// | NullPtr
+/// | Integral of string
+/// | Template of string
+/// | TemplateExpansion of string
+/// | Expression of stmt
+/// | Pack of template_argument list
+/// ]
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTemplateArgument(const TemplateArgument &A) {
+  switch (A.getKind()) {
+  case TemplateArgument::Null:
+    OF.emitSimpleVariant("Null");
+    break;
+  case TemplateArgument::Type: {
+    VariantScope Scope(OF, "Type");
+    dumpQualType(A.getAsType());
+    break;
+  }
+  case TemplateArgument::Declaration: {
+    VariantScope Scope(OF, "Declaration");
+    dumpPointer(A.getAsDecl());
+    break;
+  }
+  case TemplateArgument::NullPtr:
+    OF.emitSimpleVariant("NullPtr");
+    break;
+  case TemplateArgument::Integral: {
+    VariantScope Scope(OF, "Integral");
+    OF.emitString(A.getAsIntegral().toString(10));
+    break;
+  }
+  case TemplateArgument::Template: {
+    VariantScope Scope(OF, "Template");
+    std::string Str;
+    llvm::raw_string_ostream Stream(Str);
+    A.getAsTemplate().dump(Stream);
+    OF.emitString(Stream.str());
+    break;
+  }
+  case TemplateArgument::TemplateExpansion: {
+    VariantScope Scope(OF, "TemplateExpansion");
+    std::string Str;
+    llvm::raw_string_ostream Stream(Str);
+    A.getAsTemplateOrTemplatePattern().dump(Stream);
+    OF.emitString(Stream.str());
+    break;
+  }
+  case TemplateArgument::Expression: {
+    VariantScope Scope(OF, "Expression");
+    dumpStmt(A.getAsExpr());
+    break;
+  }
+  case TemplateArgument::Pack: {
+    VariantScope Scope(OF, "Pack");
+    ArrayScope aScope(OF, A.pack_size());
+    for (TemplateArgument::pack_iterator I = A.pack_begin(), E = A.pack_end();
+         I != E; ++I) {
+      dumpTemplateArgument(*I);
+    }
+    break;
+  }
+  }
+}
+
+/// \atd
+/// type template_specialization_info = {
+///   template_decl : pointer;
+///   kind : template_specialization_kind;
+///   ~specialization_args : template_argument list
+/// } <ocaml field_prefix="tsi_">
+///
+/// type template_specialization_kind = [
+///   Undeclared
+/// | ImplicitInstantiation
+/// | ExplicitSpecialization
+/// | ExplicitInstantiationDeclaration
+/// | ExplicitInstantiationDefinition
+/// ]
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTemplateSpecializationInfo(const Decl &Template,
+                                                            TemplateSpecializationKind Kind,
+                                                            const TemplateArgumentList &Args) {
+  bool HasArgs = Args.size() > 0;
+  RecordFields<atd::template_specialization_info> Fields;
+  Fields.set(atd::template_specialization_info::specialization_args, HasArgs);
+  ObjectScope Scope(OF, Fields);
+  OF.emitTag("template_decl");
+  dumpPointer(&Template);
+  OF.emitTag("kind");
+  switch (Kind) {
+  case TSK_Undeclared:
+    OF.emitSimpleVariant("Undeclared");
+    break;
+  case TSK_ImplicitInstantiation:
+    OF.emitSimpleVariant("ImplicitInstantiation");
+    break;
+  case TSK_ExplicitSpecialization:
+    OF.emitSimpleVariant("ExplicitSpecialization");
+    break;
+  case TSK_ExplicitInstantiationDeclaration:
+    OF.emitSimpleVariant("ExplicitInstantiationDeclaration");
+    break;
+  case TSK_ExplicitInstantiationDefinition:
+    OF.emitSimpleVariant("ExplicitInstantiationDefinition");
+    break;
+  }
+  if (HasArgs) {
+    OF.emitTag("specialization_args");
+    dumpTemplateArgumentList(Args);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  Decl dumping methods.
+//===----------------------------------------------------------------------===//
+
+/// \atd
+#define DECL(DERIVED, BASE) /// #define @DERIVED@_decl_tuple @BASE@_tuple
+#define ABSTRACT_DECL(DECL) DECL
+#include <clang/AST/DeclNodes.inc>
+///
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpDecl(const Decl *D) {
   if (!D) {
     // We use a fixed EmptyDecl node to represent null pointers
     D = NullPtrDecl;
   }
+  // The root of the translation unit is never truncated.
+  TruncationReason Reason = isa<TranslationUnitDecl>(D) ? NotTruncated : consumeNodeBudget();
+  if (Reason != NotTruncated) {
+    dumpTruncatedDecl(*D, Reason);
+    return;
+  }
   VariantScope Scope(OF, std::string(D->getDeclKindName()) + "Decl");
   {
     TupleScope Scope(OF, ASTExporter::tupleSizeOfDeclKind(D->getKind()));
@@ -1058,8 +2053,80 @@ void ASTExporter<ATDWriter>::dumpDecl(const Decl *D) {
   }
 }
 
+/// Return the comment attached to D itself, if any. The comments parsed by
+/// ASTContext::getCommentForDecl are cached per canonical declaration, which
+/// would give every redeclaration the comment of the first one parsed, so
+/// they are cached per raw comment instead. Declarations that share a raw
+/// comment share its source location, and parse it alike.
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::DeclTupleSize() { return 1; }
+const FullComment *ASTExporter<ATDWriter>::getLocalComment(const Decl *D) {
+  if (!Options.exportComments) {
+    return nullptr;
+  }
+  const ASTContext &Context = D->getASTContext();
+  const RawComment *RC = Context.getRawCommentForDeclNoCache(D);
+  if (!RC) {
+    return nullptr;
+  }
+  const FullComment *&Comment = ParsedComments[RC];
+  if (!Comment) {
+    // same as ASTContext::getLocalCommentForDeclUncached
+    Comment = RC->parse(Context, nullptr, D);
+  }
+  return Comment;
+}
+
+/// \atd
+/// type decl_selection = {
+///   decls : decl list;
+///   types : c_type list
+/// } <ocaml field_prefix="dsel_">
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpDeclSelection(ASTContext &Context,
+                                               const std::vector<const Decl*> &Decls) {
+  ObjectScope Scope(OF, 2);
+  OF.emitTag("decls");
+  {
+    ArrayScope Scope(OF, Decls.size());
+    for (const Decl *D : Decls) {
+      dumpDecl(D);
+    }
+  }
+  OF.emitTag("types");
+  dumpTypeTable(Context, true);
+}
+
+/// Dumps the types referred to by the output, or else all the types of the
+/// context. Declarations may be deserialized lazily while being dumped, and so
+/// may the types they refer to: these are appended to the table.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTypeTable(const ASTContext &Context, bool ShouldDumpTypes) {
+  if (ShouldListReferencedTypes) {
+    // Dumping a type may refer to further types, which are appended to the list.
+    ArrayScope Scope(OF);
+    for (size_t i = 0; i < ReferencedTypes.size(); i++) {
+      dumpType(ReferencedTypes[i]);
+    }
+    dumpType(nullptr);
+    return;
+  }
+  // Keep NoneType at the end of the table.
+  types.pop_back();
+  const SmallVectorImpl<Type*> &ContextTypes = Context.getTypes();
+  for (size_t i = types.size(); i < ContextTypes.size(); i++) {
+    types.push_back(ContextTypes[i]);
+  }
+  types.push_back(nullptr);
+  ArrayScope Scope(OF, ShouldDumpTypes ? types.size() : 0);
+  if (ShouldDumpTypes) {
+    for (const Type* type : types) {
+      dumpType(type);
+    }
+  }
+}
+
+template <class ATDWriter>
+constexpr int ASTExporter<ATDWriter>::DeclTupleSize() { return 1; }
 /// \atd
 /// #define decl_tuple decl_info
 /// type decl_info = {
@@ -1074,7 +2141,10 @@ int ASTExporter<ATDWriter>::DeclTupleSize() { return 1; }
 ///   ~is_this_declaration_referenced : bool;
 ///   ~is_invalid_decl : bool;
 ///   attributes : attribute list;
-///   ?full_comment : comment option
+///   ?full_comment : comment option;
+///   ?truncation : truncation option;
+///   ?imported_decl : imported_decl option;
+///   ?key : string option
 /// } <ocaml field_prefix="di_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitDecl(const Decl *D) {
@@ -1087,10 +2157,21 @@ void ASTExporter<ATDWriter>::VisitDecl(const Decl *D) {
     bool IsDUsed = D->isUsed();
     bool IsDReferenced = D->isThisDeclarationReferenced();
     bool IsDInvalid = D->isInvalidDecl();
-    const FullComment *Comment = D->getASTContext().getLocalCommentForDeclUncached(D);
-    int maxSize = 4 + ShouldEmitParentPointer + (bool) M + IsNDHidden + IsDImplicit + IsDUsed
-      + IsDReferenced + IsDInvalid + (bool) Comment;
-    ObjectScope Scope(OF, maxSize);
+    const FullComment *Comment = getLocalComment(D);
+    bool ShouldEmitKey = Options.declKeys;
+    // previous_decl is counted as present, whether it is emitted or not
+    RecordFields<atd::decl_info> Fields;
+    Fields.set(atd::decl_info::parent_pointer, ShouldEmitParentPointer)
+          .set(atd::decl_info::previous_decl)
+          .set(atd::decl_info::owning_module, M)
+          .set(atd::decl_info::is_hidden, IsNDHidden)
+          .set(atd::decl_info::is_implicit, IsDImplicit)
+          .set(atd::decl_info::is_used, IsDUsed)
+          .set(atd::decl_info::is_this_declaration_referenced, IsDReferenced)
+          .set(atd::decl_info::is_invalid_decl, IsDInvalid)
+          .set(atd::decl_info::full_comment, Comment)
+          .set(atd::decl_info::key, ShouldEmitKey);
+    ObjectScope Scope(OF, Fields);
 
     OF.emitTag("pointer");
     dumpPointer(D);
@@ -1124,11 +2205,15 @@ void ASTExporter<ATDWriter>::VisitDecl(const Decl *D) {
       OF.emitTag("full_comment");
       dumpFullComment(Comment);
     }
+    if (ShouldEmitKey) {
+      OF.emitTag("key");
+      emitString(getDeclKey(*D));
+    }
   }
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CapturedDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CapturedDeclTupleSize() {
   return DeclTupleSize() + DeclContextTupleSize();
 }
 /// \atd
@@ -1140,7 +2225,7 @@ void ASTExporter<ATDWriter>::VisitCapturedDecl(const CapturedDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::LinkageSpecDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::LinkageSpecDeclTupleSize() {
   return DeclTupleSize() + DeclContextTupleSize();
 }
 /// \atd
@@ -1152,7 +2237,7 @@ void ASTExporter<ATDWriter>::VisitLinkageSpecDecl(const LinkageSpecDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::NamespaceDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::NamespaceDeclTupleSize() {
   return NamedDeclTupleSize() + DeclContextTupleSize() + 1;
 }
 /// \atd
@@ -1168,7 +2253,10 @@ void ASTExporter<ATDWriter>::VisitNamespaceDecl(const NamespaceDecl *D) {
 
   bool IsInline = D->isInline();
   bool IsOriginalNamespace = D->isOriginalNamespace();
-  ObjectScope Scope(OF, 0 + IsInline + !IsOriginalNamespace);
+  RecordFields<atd::namespace_decl_info> Fields;
+  Fields.set(atd::namespace_decl_info::is_inline, IsInline)
+        .set(atd::namespace_decl_info::original_namespace, !IsOriginalNamespace);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_inline", IsInline);
   if (!IsOriginalNamespace) {
@@ -1178,7 +2266,7 @@ void ASTExporter<ATDWriter>::VisitNamespaceDecl(const NamespaceDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCContainerDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCContainerDeclTupleSize() {
   return NamedDeclTupleSize() + DeclContextTupleSize();
 }
 /// \atd
@@ -1190,7 +2278,7 @@ void ASTExporter<ATDWriter>::VisitObjCContainerDecl(const ObjCContainerDecl *D)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::TagDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::TagDeclTupleSize() {
   return TypeDeclTupleSize() + DeclContextTupleSize();
 }
 /// \atd
@@ -1202,7 +2290,7 @@ void ASTExporter<ATDWriter>::VisitTagDecl(const TagDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::TypeDeclTupleSize () {
+constexpr int ASTExporter<ATDWriter>::TypeDeclTupleSize() {
   return NamedDeclTupleSize() + 1 + 1;
 }
 /// \atd
@@ -1212,11 +2300,12 @@ void ASTExporter<ATDWriter>::VisitTypeDecl(const TypeDecl *D) {
   VisitNamedDecl(D);
   const Type* T = D->getTypeForDecl();
   dumpTypeOld(T);
+  noteReferencedType(T);
   dumpPointer(T);
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ValueDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ValueDeclTupleSize() {
   return NamedDeclTupleSize() + 1;
 }
 /// \atd
@@ -1229,7 +2318,7 @@ void ASTExporter<ATDWriter>::VisitValueDecl(const ValueDecl *D) {
 
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::TranslationUnitDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::TranslationUnitDeclTupleSize() {
   return DeclTupleSize() + DeclContextTupleSize() + 1;
 }
 /// \atd
@@ -1238,14 +2327,16 @@ template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitTranslationUnitDecl(const TranslationUnitDecl *D) {
   VisitDecl(D);
   VisitDeclContext(D);
-  ArrayScope Scope(OF, types.size());
-  for (const Type* type : types) {
-    dumpType(type);
-  }
+  uint64_t Offset = OS.tell();
+  // Types are not counted against the budgets, see ASTExporterOptions::maxNodes.
+  // Each shard lists the types that it refers to, if the table only lists
+  // those, but otherwise the table is written only once across shards.
+  dumpTypeTable(D->getASTContext(), Shard == 0);
+  typesRange = {Offset, OS.tell() - Offset};
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::NamedDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::NamedDeclTupleSize() {
   return DeclTupleSize() + 1;
 }
 /// \atd
@@ -1257,7 +2348,7 @@ void ASTExporter<ATDWriter>::VisitNamedDecl(const NamedDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::TypedefDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::TypedefDeclTupleSize() {
   return ASTExporter::TypedefNameDeclTupleSize() + 1;
 }
 /// \atd
@@ -1270,13 +2361,15 @@ void ASTExporter<ATDWriter>::VisitTypedefDecl(const TypedefDecl *D) {
   ASTExporter<ATDWriter>::VisitTypedefNameDecl(D);
 
   bool IsModulePrivate = D->isModulePrivate();
-  ObjectScope Scope(OF, 0 + IsModulePrivate);
+  RecordFields<atd::typedef_decl_info> Fields;
+  Fields.set(atd::typedef_decl_info::is_module_private, IsModulePrivate);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_module_private", IsModulePrivate);
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::EnumDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::EnumDeclTupleSize() {
   return TagDeclTupleSize() + 1;
 }
 /// \atd
@@ -1292,7 +2385,10 @@ void ASTExporter<ATDWriter>::VisitEnumDecl(const EnumDecl *D) {
 
   bool IsScoped = D->isScoped();
   bool IsModulePrivate = D->isModulePrivate();
-  ObjectScope Scope(OF, 0 + IsScoped + IsModulePrivate); // not covered by tests
+  RecordFields<atd::enum_decl_info> Fields;
+  Fields.set(atd::enum_decl_info::scope, IsScoped)
+        .set(atd::enum_decl_info::is_module_private, IsModulePrivate);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (IsScoped) {
     OF.emitTag("scope");
@@ -1305,7 +2401,7 @@ void ASTExporter<ATDWriter>::VisitEnumDecl(const EnumDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::RecordDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::RecordDeclTupleSize() {
   return TagDeclTupleSize() + 1;
 }
 /// \atd
@@ -1320,14 +2416,17 @@ void ASTExporter<ATDWriter>::VisitRecordDecl(const RecordDecl *D) {
 
   bool IsModulePrivate = D->isModulePrivate();
   bool IsCompleteDefinition = D->isCompleteDefinition();
-  ObjectScope Scope(OF, 0 + IsModulePrivate + IsCompleteDefinition);
+  RecordFields<atd::record_decl_info> Fields;
+  Fields.set(atd::record_decl_info::is_module_private, IsModulePrivate)
+        .set(atd::record_decl_info::is_complete_definition, IsCompleteDefinition);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_module_private", IsModulePrivate);
   OF.emitFlag("is_complete_definition", IsCompleteDefinition);
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::EnumConstantDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::EnumConstantDeclTupleSize() {
   return ValueDeclTupleSize() + 1;
 }
 /// \atd
@@ -1340,7 +2439,9 @@ void ASTExporter<ATDWriter>::VisitEnumConstantDecl(const EnumConstantDecl *D) {
   VisitValueDecl(D);
 
   const Expr *Init = D->getInitExpr();
-  ObjectScope Scope(OF, 0 + (bool) Init); // not covered by tests
+  RecordFields<atd::enum_constant_decl_info> Fields;
+  Fields.set(atd::enum_constant_decl_info::init_expr, Init);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (Init) {
     OF.emitTag("init_expr");
@@ -1349,7 +2450,7 @@ void ASTExporter<ATDWriter>::VisitEnumConstantDecl(const EnumConstantDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::IndirectFieldDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::IndirectFieldDeclTupleSize() {
   return ValueDeclTupleSize() + 1;
 }
 /// \atd
@@ -1364,7 +2465,7 @@ void ASTExporter<ATDWriter>::VisitIndirectFieldDecl(const IndirectFieldDecl *D)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::FunctionDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::FunctionDeclTupleSize() {
   return ASTExporter::DeclaratorDeclTupleSize() + 1;
 }
 /// \atd
@@ -1379,6 +2480,8 @@ int ASTExporter<ATDWriter>::FunctionDeclTupleSize() {
 ///   ~decls_in_prototype_scope : decl list;
 ///   ~parameters : decl list;
 ///   ~cxx_ctor_initializers : cxx_ctor_initializer list;
+///   ?template_specialization : template_specialization_info option;
+///   ?body_hash : string option;
 ///   ?body : stmt option
 /// } <ocaml field_prefix="fdi_">
 template <class ATDWriter>
@@ -1396,10 +2499,24 @@ void ASTExporter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *D) {
   const CXXConstructorDecl *C = dyn_cast<CXXConstructorDecl>(D);
   bool HasCtorInitializers = C && C->init_begin() != C->init_end();
   bool HasDeclarationBody = D->doesThisDeclarationHaveABody();
-  // suboptimal: decls_in_prototype_scope and parameters not taken into account accurately
-  int size = 2 + HasStorageClass + IsInlineSpecified + IsVirtualAsWritten + IsModulePrivate + IsPure
-    + IsDeletedAsWritten + HasCtorInitializers + HasDeclarationBody;
-  ObjectScope Scope(OF, size);
+  const Stmt *Body = HasDeclarationBody ? D->getBody() : nullptr;
+  bool HasBodyHash = shouldDumpBodyHash(Body);
+  const FunctionTemplateSpecializationInfo *FTSI = D->getTemplateSpecializationInfo();
+  bool HasTemplateSpecialization = FTSI;
+  RecordFields<atd::function_decl_info> Fields;
+  Fields.set(atd::function_decl_info::storage_class, HasStorageClass)
+        .set(atd::function_decl_info::is_inline, IsInlineSpecified)
+        .set(atd::function_decl_info::is_virtual, IsVirtualAsWritten)
+        .set(atd::function_decl_info::is_module_private, IsModulePrivate)
+        .set(atd::function_decl_info::is_pure, IsPure)
+        .set(atd::function_decl_info::is_delete_as_written, IsDeletedAsWritten)
+        .set(atd::function_decl_info::decls_in_prototype_scope, !D->getDeclsInPrototypeScope().empty())
+        .set(atd::function_decl_info::parameters, D->param_size() != 0)
+        .set(atd::function_decl_info::cxx_ctor_initializers, HasCtorInitializers)
+        .set(atd::function_decl_info::template_specialization, HasTemplateSpecialization)
+        .set(atd::function_decl_info::body_hash, HasBodyHash)
+        .set(atd::function_decl_info::body, Body);
+  ObjectScope Scope(OF, Fields);
 
   if (HasStorageClass) {
     OF.emitTag("storage_class");
@@ -1423,15 +2540,6 @@ void ASTExporter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *D) {
 //      OS << " noexcept-uninstantiated " << EPI.ExceptionSpec.SourceTemplate;
 //      break;
 //    }
-//  }
-//
-//  const FunctionTemplateSpecializationInfo *FTSI =
-//      D->getTemplateSpecializationInfo();
-//  bool HasTemplateSpecialization = FTSI;
-//
-//
-//  if (HasTemplateSpecialization) {
-//    dumpTemplateArgumentList(*FTSI->TemplateArguments);
 //  }
 
   {
@@ -1464,17 +2572,22 @@ void ASTExporter<ATDWriter>::VisitFunctionDecl(const FunctionDecl *D) {
     }
   }
 
-  if (HasDeclarationBody) {
-    const Stmt *Body = D->getBody();
-    if (Body) {
-      OF.emitTag("body");
-      dumpStmt(Body);
-    }
+  if (HasTemplateSpecialization) {
+    OF.emitTag("template_specialization");
+    dumpTemplateSpecializationInfo(*FTSI->getTemplate(),
+                                   FTSI->getTemplateSpecializationKind(),
+                                   *FTSI->TemplateArguments);
+  }
+
+  if (Body) {
+    dumpBodyHash(*D, Body);
+    OF.emitTag("body");
+    dumpBody(*D, Body);
   }
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::FieldDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::FieldDeclTupleSize() {
   return ASTExporter::DeclaratorDeclTupleSize() + 1;
 }
 /// \atd
@@ -1493,7 +2606,12 @@ void ASTExporter<ATDWriter>::VisitFieldDecl(const FieldDecl *D) {
   bool IsModulePrivate = D->isModulePrivate();
   bool HasBitWidth = D->isBitField() && D->getBitWidth();
   Expr *Init = D->getInClassInitializer();
-  ObjectScope Scope(OF, 0 + IsMutable + IsModulePrivate + HasBitWidth + (bool) Init); // not covered by tests
+  RecordFields<atd::field_decl_info> Fields;
+  Fields.set(atd::field_decl_info::is_mutable, IsMutable)
+        .set(atd::field_decl_info::is_module_private, IsModulePrivate)
+        .set(atd::field_decl_info::init_expr, Init)
+        .set(atd::field_decl_info::bit_width_expr, HasBitWidth);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitFlag("is_mutable", IsMutable);
   OF.emitFlag("is_module_private", IsModulePrivate);
@@ -1510,7 +2628,7 @@ void ASTExporter<ATDWriter>::VisitFieldDecl(const FieldDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::VarDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::VarDeclTupleSize() {
   return ASTExporter::DeclaratorDeclTupleSize() + 1;
 }
 /// \atd
@@ -1533,8 +2651,13 @@ void ASTExporter<ATDWriter>::VisitVarDecl(const VarDecl *D) {
   bool IsModulePrivate = D->isModulePrivate();
   bool IsNRVOVariable = D->isNRVOVariable();
   bool HasInit = D->hasInit();
-  // suboptimal: tls_kind is not taken into account accurately
-  ObjectScope Scope(OF, 1 + HasStorageClass + IsModulePrivate + IsNRVOVariable + HasInit);
+  RecordFields<atd::var_decl_info> Fields;
+  Fields.set(atd::var_decl_info::storage_class, HasStorageClass)
+        .set(atd::var_decl_info::tls_kind, D->getTLSKind() != VarDecl::TLS_None)
+        .set(atd::var_decl_info::is_module_private, IsModulePrivate)
+        .set(atd::var_decl_info::is_nrvo_variable, IsNRVOVariable)
+        .set(atd::var_decl_info::init_expr, HasInit);
+  ObjectScope Scope(OF, Fields);
 
   if (HasStorageClass) {
     OF.emitTag("storage_class");
@@ -1556,7 +2679,7 @@ void ASTExporter<ATDWriter>::VisitVarDecl(const VarDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::FileScopeAsmDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::FileScopeAsmDeclTupleSize() {
   return DeclTupleSize() + 1;
 }
 /// \atd
@@ -1568,7 +2691,7 @@ void ASTExporter<ATDWriter>::VisitFileScopeAsmDecl(const FileScopeAsmDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ImportDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ImportDeclTupleSize() {
   return DeclTupleSize() + 1;
 }
 /// \atd
@@ -1584,7 +2707,7 @@ void ASTExporter<ATDWriter>::VisitImportDecl(const ImportDecl *D) {
 //===----------------------------------------------------------------------===//
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::UsingDirectiveDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::UsingDirectiveDeclTupleSize() {
   return NamedDeclTupleSize() + 1;
 }
 /// \atd
@@ -1600,7 +2723,9 @@ void ASTExporter<ATDWriter>::VisitUsingDirectiveDecl(const UsingDirectiveDecl *D
   VisitNamedDecl(D);
 
   bool HasNominatedNamespace = D->getNominatedNamespace();
-  ObjectScope Scope(OF, 3 + HasNominatedNamespace);
+  RecordFields<atd::using_directive_decl_info> Fields;
+  Fields.set(atd::using_directive_decl_info::nominated_namespace, HasNominatedNamespace);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("using_location");
   dumpSourceLocation(D->getUsingLoc());
@@ -1615,7 +2740,7 @@ void ASTExporter<ATDWriter>::VisitUsingDirectiveDecl(const UsingDirectiveDecl *D
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::NamespaceAliasDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::NamespaceAliasDeclTupleSize() {
   return NamedDeclTupleSize() + 1;
 }
 /// \atd
@@ -1641,7 +2766,7 @@ void ASTExporter<ATDWriter>::VisitNamespaceAliasDecl(const NamespaceAliasDecl *D
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXRecordDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXRecordDeclTupleSize() {
   return RecordDeclTupleSize() + 1;
 }
 /// \atd
@@ -1678,7 +2803,11 @@ void ASTExporter<ATDWriter>::VisitCXXRecordDecl(const CXXRecordDecl *D) {
   bool HasVBases = vBases.size() > 0;
   bool HasNonVBases = nonVBases.size() > 0;
   bool IsCLike = D->isCLike();
-  ObjectScope Scope(OF, 0 + HasNonVBases + HasVBases + IsCLike);
+  RecordFields<atd::cxx_record_decl_info> Fields;
+  Fields.set(atd::cxx_record_decl_info::bases, HasNonVBases)
+        .set(atd::cxx_record_decl_info::vbases, HasVBases)
+        .set(atd::cxx_record_decl_info::is_c_like, IsCLike);
+  ObjectScope Scope(OF, Fields);
 
   if (HasNonVBases) {
     OF.emitTag("bases");
@@ -1715,68 +2844,109 @@ void ASTExporter<ATDWriter>::VisitCXXRecordDecl(const CXXRecordDecl *D) {
 //  dumpStmt(D->getMessage());
 //}
 //
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::VisitFunctionTemplateDecl(const FunctionTemplateDecl *D) {
-//  dumpName(D);
-//  dumpTemplateParameters(D->getTemplateParameters());
-//  dumpDecl(D->getTemplatedDecl());
-//  for (FunctionTemplateDecl::spec_iterator I = D->spec_begin(),
-//                                           E = D->spec_end();
-//       I != E; ++I) {
-//    FunctionTemplateDecl::spec_iterator Next = I;
-//    ++Next;
-//    switch (I->getTemplateSpecializationKind()) {
-//    case TSK_Undeclared:
-//    case TSK_ImplicitInstantiation:
-//    case TSK_ExplicitInstantiationDeclaration:
-//    case TSK_ExplicitInstantiationDefinition:
-//      if (D == D->getCanonicalDecl())
-//        dumpDecl(*I);
-//      else
-//        dumpDeclRef(*I);
-//      break;
-//    case TSK_ExplicitSpecialization:
-//      dumpDeclRef(*I);
-//      break;
-//    }
-//  }
-//}
-//
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::VisitClassTemplateDecl(const ClassTemplateDecl *D) {
-//  dumpName(D);
-//  dumpTemplateParameters(D->getTemplateParameters());
-//
-//  ClassTemplateDecl::spec_iterator I = D->spec_begin();
-//  ClassTemplateDecl::spec_iterator E = D->spec_end();
-//  dumpDecl(D->getTemplatedDecl());
-//  for (; I != E; ++I) {
-//    ClassTemplateDecl::spec_iterator Next = I;
-//    ++Next;
-//    switch (I->getTemplateSpecializationKind()) {
-//    case TSK_Undeclared:
-//    case TSK_ImplicitInstantiation:
-//      if (D == D->getCanonicalDecl())
-//        dumpDecl(*I);
-//      else
-//        dumpDeclRef(*I);
-//      break;
-//    case TSK_ExplicitSpecialization:
-//    case TSK_ExplicitInstantiationDeclaration:
-//    case TSK_ExplicitInstantiationDefinition:
-//      dumpDeclRef(*I);
-//      break;
-//    }
-//  }
-//}
-//
-//template <class ATDWriter>
-//void ASTExporter<ATDWriter>::VisitClassTemplateSpecializationDecl(
-//    const ClassTemplateSpecializationDecl *D) {
-//  VisitCXXRecordDecl(D);
-//  dumpTemplateArgumentList(D->getTemplateArgs());
-//}
-//
+static TemplateSpecializationKind getSpecializationKind(const ClassTemplateSpecializationDecl *D) {
+  return D->getSpecializationKind();
+}
+
+static TemplateSpecializationKind getSpecializationKind(const FunctionDecl *D) {
+  return D->getTemplateSpecializationKind();
+}
+
+/// \atd
+/// type template_decl_info = {
+///   ~specializations : template_specialization list
+/// } <ocaml field_prefix="tmpi_">
+///
+/// type template_specialization = [
+///   Instantiation of decl
+/// | SpecializationRef of decl_ref
+/// ]
+template <class ATDWriter>
+template <class TemplateDeclT>
+void ASTExporter<ATDWriter>::dumpTemplateDeclInfo(const TemplateDeclT *D, bool DumpExplicitInstantiations) {
+  // Implicit instantiations do not belong to any DeclContext. They are dumped
+  // once, below the canonical declaration of their template. Specializations
+  // written in the source are dumped in their DeclContext and only referred to here.
+  std::vector<std::pair<const Decl*, bool>> Specializations;
+  for (const auto *Spec : D->specializations()) {
+    bool ShouldDump = false;
+    switch (getSpecializationKind(Spec)) {
+    case TSK_Undeclared:
+    case TSK_ImplicitInstantiation:
+      ShouldDump = true;
+      break;
+    case TSK_ExplicitInstantiationDeclaration:
+    case TSK_ExplicitInstantiationDefinition:
+      ShouldDump = DumpExplicitInstantiations;
+      break;
+    case TSK_ExplicitSpecialization:
+      break;
+    }
+    ShouldDump = ShouldDump && D == D->getCanonicalDecl()
+      && DumpedSpecializations.insert(Spec).second;
+    Specializations.push_back(std::make_pair(Spec, ShouldDump));
+  }
+
+  bool HasSpecializations = !Specializations.empty();
+  RecordFields<atd::template_decl_info> Fields;
+  Fields.set(atd::template_decl_info::specializations, HasSpecializations);
+  ObjectScope Scope(OF, Fields);
+
+  if (HasSpecializations) {
+    OF.emitTag("specializations");
+    ArrayScope aScope(OF, Specializations.size());
+    for (const auto &Spec : Specializations) {
+      if (Spec.second) {
+        VariantScope vScope(OF, "Instantiation");
+        dumpDecl(Spec.first);
+      } else {
+        VariantScope vScope(OF, "SpecializationRef");
+        dumpDeclRef(*Spec.first);
+      }
+    }
+  }
+}
+
+template <class ATDWriter>
+constexpr int ASTExporter<ATDWriter>::FunctionTemplateDeclTupleSize() {
+  return NamedDeclTupleSize() + 1;
+}
+/// \atd
+/// #define function_template_decl_tuple named_decl_tuple * template_decl_info
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::VisitFunctionTemplateDecl(const FunctionTemplateDecl *D) {
+  VisitNamedDecl(D);
+  // Explicit instantiations of functions do not appear in any DeclContext either.
+  dumpTemplateDeclInfo(D, true);
+}
+
+template <class ATDWriter>
+constexpr int ASTExporter<ATDWriter>::ClassTemplateDeclTupleSize() {
+  return NamedDeclTupleSize() + 1;
+}
+/// \atd
+/// #define class_template_decl_tuple named_decl_tuple * template_decl_info
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::VisitClassTemplateDecl(const ClassTemplateDecl *D) {
+  VisitNamedDecl(D);
+  dumpTemplateDeclInfo(D, false);
+}
+
+template <class ATDWriter>
+constexpr int ASTExporter<ATDWriter>::ClassTemplateSpecializationDeclTupleSize() {
+  return CXXRecordDeclTupleSize() + 1;
+}
+/// \atd
+/// #define class_template_specialization_decl_tuple cxx_record_decl_tuple * template_specialization_info
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::VisitClassTemplateSpecializationDecl(
+    const ClassTemplateSpecializationDecl *D) {
+  VisitCXXRecordDecl(D);
+  dumpTemplateSpecializationInfo(*D->getSpecializedTemplate(),
+                                 D->getSpecializationKind(),
+                                 D->getTemplateArgs());
+}
+
 //template <class ATDWriter>
 //void ASTExporter<ATDWriter>::VisitClassTemplatePartialSpecializationDecl(
 //    const ClassTemplatePartialSpecializationDecl *D) {
@@ -1924,7 +3094,7 @@ void ASTExporter<ATDWriter>::VisitCXXRecordDecl(const CXXRecordDecl *D) {
 ////===----------------------------------------------------------------------===//
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCIvarDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCIvarDeclTupleSize() {
   return FieldDeclTupleSize() + 1;
 }
 /// \atd
@@ -1939,8 +3109,10 @@ void ASTExporter<ATDWriter>::VisitObjCIvarDecl(const ObjCIvarDecl *D) {
   VisitFieldDecl(D);
 
   bool IsSynthesize = D->getSynthesize();
-  // suboptimal: access_control not taken into account accurately
-  ObjectScope Scope(OF, 1 + IsSynthesize); // not covered by tests
+  RecordFields<atd::obj_c_ivar_decl_info> Fields;
+  Fields.set(atd::obj_c_ivar_decl_info::is_synthesize, IsSynthesize)
+        .set(atd::obj_c_ivar_decl_info::access_control, D->getAccessControl() != ObjCIvarDecl::None);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitFlag("is_synthesize", IsSynthesize);
 
@@ -1968,7 +3140,7 @@ void ASTExporter<ATDWriter>::VisitObjCIvarDecl(const ObjCIvarDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCMethodDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCMethodDeclTupleSize() {
   return NamedDeclTupleSize() + 1;
 }
 /// \atd
@@ -1978,6 +3150,7 @@ int ASTExporter<ATDWriter>::ObjCMethodDeclTupleSize() {
 ///   result_type : qual_type;
 ///   ~parameters : decl list;
 ///   ~is_variadic : bool;
+///   ?body_hash : string option;
 ///   ?body : stmt option;
 /// } <ocaml field_prefix="omdi_">
 template <class ATDWriter>
@@ -1990,7 +3163,14 @@ void ASTExporter<ATDWriter>::VisitObjCMethodDecl(const ObjCMethodDecl *D) {
   bool HasParameters = I != E;
   bool IsVariadic = D->isVariadic();
   const Stmt *Body = D->getBody();
-  ObjectScope Scope(OF, 1 + IsInstanceMethod + HasParameters + IsVariadic + (bool) Body);
+  bool HasBodyHash = shouldDumpBodyHash(Body);
+  RecordFields<atd::obj_c_method_decl_info> Fields;
+  Fields.set(atd::obj_c_method_decl_info::is_instance_method, IsInstanceMethod)
+        .set(atd::obj_c_method_decl_info::parameters, HasParameters)
+        .set(atd::obj_c_method_decl_info::is_variadic, IsVariadic)
+        .set(atd::obj_c_method_decl_info::body_hash, HasBodyHash)
+        .set(atd::obj_c_method_decl_info::body, Body);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_instance_method", IsInstanceMethod);
   OF.emitTag("result_type");
@@ -2007,13 +3187,14 @@ void ASTExporter<ATDWriter>::VisitObjCMethodDecl(const ObjCMethodDecl *D) {
   OF.emitFlag("is_variadic", IsVariadic);
 
   if (Body) {
+    dumpBodyHash(*D, Body);
     OF.emitTag("body");
-    dumpStmt(Body);
+    dumpBody(*D, Body);
   }
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCCategoryDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCCategoryDeclTupleSize() {
   return ObjCContainerDeclTupleSize() + 1;
 }
 /// \atd
@@ -2032,7 +3213,11 @@ void ASTExporter<ATDWriter>::VisitObjCCategoryDecl(const ObjCCategoryDecl *D) {
   ObjCCategoryDecl::protocol_iterator I = D->protocol_begin(),
     E = D->protocol_end();
   bool HasProtocols = I != E;
-  ObjectScope Scope(OF, 0 + (bool) CI + (bool) Impl + HasProtocols); // not covered by tests
+  RecordFields<atd::obj_c_category_decl_info> Fields;
+  Fields.set(atd::obj_c_category_decl_info::class_interface, CI)
+        .set(atd::obj_c_category_decl_info::implementation, Impl)
+        .set(atd::obj_c_category_decl_info::protocols, HasProtocols);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (CI) {
     OF.emitTag("class_interface");
@@ -2053,7 +3238,7 @@ void ASTExporter<ATDWriter>::VisitObjCCategoryDecl(const ObjCCategoryDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCCategoryImplDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCCategoryImplDeclTupleSize() {
   return ASTExporter::ObjCImplDeclTupleSize() + 1;
 }
 /// \atd
@@ -2068,7 +3253,10 @@ void ASTExporter<ATDWriter>::VisitObjCCategoryImplDecl(const ObjCCategoryImplDec
 
   const ObjCInterfaceDecl *CI = D->getClassInterface();
   const ObjCCategoryDecl *CD = D->getCategoryDecl();
-  ObjectScope Scope(OF, 0 + (bool) CI + (bool) CD); // not covered by tests
+  RecordFields<atd::obj_c_category_impl_decl_info> Fields;
+  Fields.set(atd::obj_c_category_impl_decl_info::class_interface, CI)
+        .set(atd::obj_c_category_impl_decl_info::category_decl, CD);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (CI) {
     OF.emitTag("class_interface");
@@ -2081,7 +3269,7 @@ void ASTExporter<ATDWriter>::VisitObjCCategoryImplDecl(const ObjCCategoryImplDec
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCProtocolDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCProtocolDeclTupleSize() {
   return ObjCContainerDeclTupleSize() + 1;
 }
 /// \atd
@@ -2096,7 +3284,9 @@ void ASTExporter<ATDWriter>::VisitObjCProtocolDecl(const ObjCProtocolDecl *D) {
   ObjCCategoryDecl::protocol_iterator I = D->protocol_begin(),
     E = D->protocol_end();
   bool HasProtocols = I != E;
-  ObjectScope Scope(OF, 0 + HasProtocols); // not covered by tests
+  RecordFields<atd::obj_c_protocol_decl_info> Fields;
+  Fields.set(atd::obj_c_protocol_decl_info::protocols, HasProtocols);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (HasProtocols) {
     OF.emitTag("protocols");
@@ -2109,7 +3299,7 @@ void ASTExporter<ATDWriter>::VisitObjCProtocolDecl(const ObjCProtocolDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCInterfaceDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCInterfaceDeclTupleSize() {
   return ObjCContainerDeclTupleSize() + 1;
 }
 /// \atd
@@ -2128,7 +3318,11 @@ void ASTExporter<ATDWriter>::VisitObjCInterfaceDecl(const ObjCInterfaceDecl *D)
   ObjCInterfaceDecl::protocol_iterator I = D->protocol_begin(),
     E = D->protocol_end();
   bool HasProtocols = I != E;
-  ObjectScope Scope(OF, 0 + (bool) SC + (bool) Impl + HasProtocols);
+  RecordFields<atd::obj_c_interface_decl_info> Fields;
+  Fields.set(atd::obj_c_interface_decl_info::super, SC)
+        .set(atd::obj_c_interface_decl_info::implementation, Impl)
+        .set(atd::obj_c_interface_decl_info::protocols, HasProtocols);
+  ObjectScope Scope(OF, Fields);
 
   if (SC) {
     OF.emitTag("super");
@@ -2149,7 +3343,7 @@ void ASTExporter<ATDWriter>::VisitObjCInterfaceDecl(const ObjCInterfaceDecl *D)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCImplementationDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCImplementationDeclTupleSize() {
   return ASTExporter::ObjCImplDeclTupleSize() + 1;
 }
 /// \atd
@@ -2168,7 +3362,11 @@ void ASTExporter<ATDWriter>::VisitObjCImplementationDecl(const ObjCImplementatio
   ObjCImplementationDecl::init_const_iterator I = D->init_begin(),
     E = D->init_end();
   bool HasInitializers = I != E;
-  ObjectScope Scope(OF, 0 + (bool) SC + (bool) CI + HasInitializers);
+  RecordFields<atd::obj_c_implementation_decl_info> Fields;
+  Fields.set(atd::obj_c_implementation_decl_info::super, SC)
+        .set(atd::obj_c_implementation_decl_info::class_interface, CI)
+        .set(atd::obj_c_implementation_decl_info::ivar_initializers, HasInitializers);
+  ObjectScope Scope(OF, Fields);
 
   if (SC) {
     OF.emitTag("super");
@@ -2189,7 +3387,7 @@ void ASTExporter<ATDWriter>::VisitObjCImplementationDecl(const ObjCImplementatio
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCCompatibleAliasDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCCompatibleAliasDeclTupleSize() {
   return NamedDeclTupleSize() + 1;
 }
 /// \atd
@@ -2202,7 +3400,9 @@ void ASTExporter<ATDWriter>::VisitObjCCompatibleAliasDecl(const ObjCCompatibleAl
   VisitNamedDecl(D);
 
   const ObjCInterfaceDecl *CI = D->getClassInterface();
-  ObjectScope Scope(OF, 0 + (bool) CI); // not covered by tests
+  RecordFields<atd::obj_c_compatible_alias_decl_info> Fields;
+  Fields.set(atd::obj_c_compatible_alias_decl_info::class_interface, CI);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (CI) {
     OF.emitTag("class_interface");
@@ -2211,7 +3411,7 @@ void ASTExporter<ATDWriter>::VisitObjCCompatibleAliasDecl(const ObjCCompatibleAl
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCPropertyDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCPropertyDeclTupleSize() {
   return NamedDeclTupleSize() + 1;
 }
 /// \atd
@@ -2246,7 +3446,10 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyDecl(const ObjCPropertyDecl *D) {
   ObjCPropertyDecl::PropertyAttributeKind Attrs = D->getPropertyAttributes();
   bool HasPropertyAttributes = Attrs != ObjCPropertyDecl::OBJC_PR_noattr;
   // NOTE: class_interface is always None
-  ObjectScope Scope(OF, 1 + HasPropertyControl + HasPropertyAttributes); // not covered by tests
+  RecordFields<atd::obj_c_property_decl_info> Fields;
+  Fields.set(atd::obj_c_property_decl_info::property_control, HasPropertyControl)
+        .set(atd::obj_c_property_decl_info::property_attributes, HasPropertyAttributes);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("qual_type");
   dumpQualType(D->getType());
@@ -2311,7 +3514,7 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyDecl(const ObjCPropertyDecl *D) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCPropertyImplDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCPropertyImplDeclTupleSize() {
   return DeclTupleSize() + 1;
 }
 /// \atd
@@ -2328,7 +3531,10 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyImplDecl(const ObjCPropertyImplDec
 
   const ObjCPropertyDecl *PD = D->getPropertyDecl();
   const ObjCIvarDecl *ID = D->getPropertyIvarDecl();
-  ObjectScope Scope(OF, 1 + (bool) PD + (bool) ID); // not covered by tests
+  RecordFields<atd::obj_c_property_impl_decl_info> Fields;
+  Fields.set(atd::obj_c_property_impl_decl_info::property_decl, PD)
+        .set(atd::obj_c_property_impl_decl_info::ivar_decl, ID);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("implementation");
   switch (D->getPropertyImplementation()) {
@@ -2346,7 +3552,7 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyImplDecl(const ObjCPropertyImplDec
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::BlockDeclTupleSize() {
+constexpr int ASTExporter<ATDWriter>::BlockDeclTupleSize() {
   return DeclTupleSize() + DeclContextTupleSize() + 1;
 }
 /// \atd
@@ -2356,6 +3562,7 @@ int ASTExporter<ATDWriter>::BlockDeclTupleSize() {
 ///   ~is_variadic : bool;
 ///   ~captures_cxx_this : bool;
 ///   ~captured_variables : block_captured_variable list;
+///   ?body_hash : string option;
 ///   ?body : stmt option;
 /// } <ocaml field_prefix="bdi_">
 ///
@@ -2377,8 +3584,15 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
   BlockDecl::capture_iterator CII = D->capture_begin(), CIE = D->capture_end();
   bool HasCapturedVariables = CII != CIE;
   const Stmt *Body = D->getBody();
-  int size = 0 + HasParameters + IsVariadic + CapturesCXXThis + HasCapturedVariables + (bool) Body;
-  ObjectScope Scope(OF, size); // not covered by tests
+  bool HasBodyHash = shouldDumpBodyHash(Body);
+  RecordFields<atd::block_decl_info> Fields;
+  Fields.set(atd::block_decl_info::parameters, HasParameters)
+        .set(atd::block_decl_info::is_variadic, IsVariadic)
+        .set(atd::block_decl_info::captures_cxx_this, CapturesCXXThis)
+        .set(atd::block_decl_info::captured_variables, HasCapturedVariables)
+        .set(atd::block_decl_info::body_hash, HasBodyHash)
+        .set(atd::block_decl_info::body, Body);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (HasParameters) {
     OF.emitTag("parameters");
@@ -2399,7 +3613,12 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
       bool IsNested = CII->isNested();
       bool HasVariable = CII->getVariable();
       bool HasCopyExpr = CII->hasCopyExpr();
-      ObjectScope Scope(OF, 0 + IsByRef + IsNested + HasVariable + HasCopyExpr); // not covered by tests
+      RecordFields<atd::block_captured_variable> Fields;
+      Fields.set(atd::block_captured_variable::is_by_ref, IsByRef)
+            .set(atd::block_captured_variable::is_nested, IsNested)
+            .set(atd::block_captured_variable::variable, HasVariable)
+            .set(atd::block_captured_variable::copy_expr, HasCopyExpr);
+      ObjectScope Scope(OF, Fields); // not covered by tests
 
       OF.emitFlag("is_by_ref", IsByRef);
       OF.emitFlag("is_nested", IsNested);
@@ -2417,8 +3636,9 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
   }
 
   if (Body) {
+    dumpBodyHash(*D, Body);
     OF.emitTag("body");
-    dumpStmt(Body);
+    dumpBody(*D, Body);
   }
 }
 
@@ -2441,13 +3661,53 @@ void ASTExporter<ATDWriter>::VisitBlockDecl(const BlockDecl *D) {
 #define ABSTRACT_STMT(STMT) STMT
 #include <clang/AST/StmtNodes.inc>
 //
+
+/// Value of a single or double precision floating literal, if any.
+static bool getNativeFloatValue(const Stmt *Node, double &Result) {
+  const FloatingLiteral *Literal = dyn_cast<FloatingLiteral>(Node);
+  if (!Literal) {
+    return false;
+  }
+  const llvm::APFloat &Value = Literal->getValue();
+  const llvm::fltSemantics &Semantics = Value.getSemantics();
+  if (!Value.isFinite()) {
+    return false;
+  }
+  if (&Semantics == &llvm::APFloat::IEEEsingle) {
+    Result = Value.convertToFloat();
+    return true;
+  }
+  if (&Semantics == &llvm::APFloat::IEEEdouble) {
+    Result = Value.convertToDouble();
+    return true;
+  }
+  return false;
+}
+
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpStmt(const Stmt *S) {
   if (!S) {
     // We use a fixed NullStmt node to represent null pointers
     S = NullPtrStmt;
   }
-  VariantScope Scope(OF, S->getStmtClassName());
+  TruncationReason Reason = consumeNodeBudget();
+  if (Reason != NotTruncated) {
+    dumpTruncatedStmt(*S, Reason);
+    return;
+  }
+  ExprWrappers Wrappers;
+  if (Options.collapseImplicitCasts) {
+    while (isa<ImplicitCastExpr>(S) || isa<ParenExpr>(S)) {
+      Wrappers.push_back(cast<Expr>(S));
+      S = isa<ParenExpr>(S) ? cast<ParenExpr>(S)->getSubExpr() : cast<ImplicitCastExpr>(S)->getSubExpr();
+    }
+    if (!Wrappers.empty()) {
+      CollapsedWrappers = &Wrappers;
+    }
+  }
+  double NativeValue;
+  bool IsNativeFloatingLiteral = Options.nativeLiterals && getNativeFloatValue(S, NativeValue);
+  VariantScope Scope(OF, IsNativeFloatingLiteral ? "NativeFloatingLiteral" : S->getStmtClassName());
   {
     TupleScope Scope(OF, ASTExporter::tupleSizeOfStmtClass(S->getStmtClass()));
     ConstStmtVisitor<ASTExporter<ATDWriter>>::Visit(S);
@@ -2455,7 +3715,7 @@ void ASTExporter<ATDWriter>::dumpStmt(const Stmt *S) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::StmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::StmtTupleSize() {
   return 2;
 }
 /// \atd
@@ -2463,6 +3723,7 @@ int ASTExporter<ATDWriter>::StmtTupleSize() {
 /// type stmt_info = {
 ///   pointer : pointer;
 ///   source_range : source_range;
+///   ?truncation : truncation option
 /// } <ocaml field_prefix="si_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitStmt(const Stmt *S) {
@@ -2483,7 +3744,7 @@ void ASTExporter<ATDWriter>::VisitStmt(const Stmt *S) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::DeclStmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::DeclStmtTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -2498,7 +3759,7 @@ void ASTExporter<ATDWriter>::VisitDeclStmt(const DeclStmt *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::AttributedStmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::AttributedStmtTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -2513,7 +3774,7 @@ void ASTExporter<ATDWriter>::VisitAttributedStmt(const AttributedStmt *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::LabelStmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::LabelStmtTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -2525,7 +3786,7 @@ void ASTExporter<ATDWriter>::VisitLabelStmt(const LabelStmt *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::GotoStmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::GotoStmtTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -2545,7 +3806,7 @@ void ASTExporter<ATDWriter>::VisitGotoStmt(const GotoStmt *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXCatchStmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXCatchStmtTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -2558,7 +3819,9 @@ void ASTExporter<ATDWriter>::VisitCXXCatchStmt(const CXXCatchStmt *Node) {
   VisitStmt(Node);
 
   const VarDecl *decl = Node->getExceptionDecl();
-  ObjectScope Scope(OF, 0 + (bool) decl); // not covered by tests
+  RecordFields<atd::cxx_catch_stmt_info> Fields;
+  Fields.set(atd::cxx_catch_stmt_info::variable, decl);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (decl) {
     OF.emitTag("variable");
@@ -2572,7 +3835,7 @@ void ASTExporter<ATDWriter>::VisitCXXCatchStmt(const CXXCatchStmt *Node) {
 //
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ExprTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -2581,6 +3844,7 @@ int ASTExporter<ATDWriter>::ExprTupleSize() {
 ///   qual_type : qual_type;
 ///   ~value_kind <ocaml default="`RValue"> : value_kind;
 ///   ~object_kind <ocaml default="`Ordinary"> : object_kind;
+///   ?collapsed_wrappers : collapsed_wrapper list option;
 /// } <ocaml field_prefix="ei_">
 ///
 /// type value_kind = [ RValue | LValue | XValue ]
@@ -2588,30 +3852,27 @@ int ASTExporter<ATDWriter>::ExprTupleSize() {
 ///
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitExpr(const Expr *Node) {
+  // Taken before the children are dumped, since they may collapse wrappers too.
+  const ExprWrappers *Wrappers = CollapsedWrappers;
+  CollapsedWrappers = nullptr;
   VisitStmt(Node);
 
   ExprValueKind VK = Node->getValueKind();
   bool HasNonDefaultValueKind = VK != VK_RValue;
   ExprObjectKind OK = Node->getObjectKind();
   bool HasNonDefaultObjectKind = OK != OK_Ordinary;
-  ObjectScope Scope(OF, 1 + HasNonDefaultValueKind + HasNonDefaultObjectKind);
+  RecordFields<atd::expr_info> Fields;
+  Fields.set(atd::expr_info::value_kind, HasNonDefaultValueKind)
+        .set(atd::expr_info::object_kind, HasNonDefaultObjectKind)
+        .set(atd::expr_info::collapsed_wrappers, Wrappers);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("qual_type");
   dumpQualType(Node->getType());
 
   if (HasNonDefaultValueKind) {
     OF.emitTag("value_kind");
-    switch (VK) {
-    case VK_LValue:
-      OF.emitSimpleVariant("LValue");
-      break;
-    case VK_XValue:
-      OF.emitSimpleVariant("XValue");
-      break;
-    default:
-      llvm_unreachable("unknown case");
-      break;
-    }
+    dumpValueKind(VK);
   }
   if (HasNonDefaultObjectKind) {
     OF.emitTag("object_kind");
@@ -2633,6 +3894,78 @@ void ASTExporter<ATDWriter>::VisitExpr(const Expr *Node) {
       break;
     }
   }
+  if (Wrappers) {
+    OF.emitTag("collapsed_wrappers");
+    ArrayScope Scope(OF, Wrappers->size());
+    for (const Expr *Wrapper : *Wrappers) {
+      dumpCollapsedWrapper(*Wrapper);
+    }
+  }
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpValueKind(ExprValueKind VK) {
+  switch (VK) {
+  case VK_LValue:
+    OF.emitSimpleVariant("LValue");
+    break;
+  case VK_XValue:
+    OF.emitSimpleVariant("XValue");
+    break;
+  default:
+    llvm_unreachable("unknown case");
+    break;
+  }
+}
+
+/// With COLLAPSE_IMPLICIT_CASTS, an ImplicitCastExpr or a ParenExpr only
+/// keeps its pointer, its type and its cast information.
+/// \atd
+/// type collapsed_wrapper = {
+///   pointer : pointer;
+///   kind : collapsed_wrapper_kind;
+///   qual_type : qual_type;
+///   ~value_kind <ocaml default="`RValue"> : value_kind;
+///   ~base_path : cxx_base_specifier list <biniou repr="table">;
+/// } <ocaml field_prefix="cw_">
+///
+/// type collapsed_wrapper_kind = [
+/// | ImplicitCast of cast_kind
+/// | Paren
+/// ]
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpCollapsedWrapper(const Expr &Wrapper) {
+  const ImplicitCastExpr *ICE = dyn_cast<ImplicitCastExpr>(&Wrapper);
+  ExprValueKind VK = Wrapper.getValueKind();
+  bool HasNonDefaultValueKind = VK != VK_RValue;
+  bool HasBasePath = ICE && ICE->path_size() > 0;
+  RecordFields<atd::collapsed_wrapper> Fields;
+  Fields.set(atd::collapsed_wrapper::value_kind, HasNonDefaultValueKind)
+        .set(atd::collapsed_wrapper::base_path, HasBasePath);
+  ObjectScope Scope(OF, Fields);
+
+  OF.emitTag("pointer");
+  dumpPointer(&Wrapper);
+  OF.emitTag("kind");
+  if (ICE) {
+    VariantScope Scope(OF, "ImplicitCast");
+    OF.emitSimpleVariant(ICE->getCastKindName());
+  } else {
+    OF.emitSimpleVariant("Paren");
+  }
+  OF.emitTag("qual_type");
+  dumpQualType(Wrapper.getType());
+  if (HasNonDefaultValueKind) {
+    OF.emitTag("value_kind");
+    dumpValueKind(VK);
+  }
+  if (HasBasePath) {
+    OF.emitTag("base_path");
+    TableScope Scope(OF, ICE->path_size());
+    for (auto I = ICE->path_begin(), E = ICE->path_end(); I != E; ++I) {
+      dumpCXXBaseSpecifier(**I);
+    }
+  }
 }
 
 /// \atd
@@ -2642,17 +3975,17 @@ void ASTExporter<ATDWriter>::VisitExpr(const Expr *Node) {
 /// } <ocaml field_prefix="xbs_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpCXXBaseSpecifier(const CXXBaseSpecifier &Base) {
-  bool IsVirtual = Base.isVirtual();
-  ObjectScope Scope(OF, 1 + IsVirtual);
+  // Base paths are tables, whose rows count every field.
+  ObjectScope Scope(OF, 2);
 
   OF.emitTag("name");
   const CXXRecordDecl *RD = cast<CXXRecordDecl>(Base.getType()->getAs<RecordType>()->getDecl());
   OF.emitString(RD->getName());
-  OF.emitFlag("virtual", IsVirtual);
+  OF.emitFlag("virtual", Base.isVirtual());
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CastExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CastExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2716,7 +4049,7 @@ int ASTExporter<ATDWriter>::CastExprTupleSize() {
 /// #define cast_expr_tuple expr_tuple * cast_expr_info
 /// type cast_expr_info = {
 ///   cast_kind : cast_kind;
-///   base_path : cxx_base_specifier list;
+///   base_path : cxx_base_specifier list <biniou repr="table">;
 /// } <ocaml field_prefix="cei_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitCastExpr(const CastExpr *Node) {
@@ -2727,7 +4060,7 @@ void ASTExporter<ATDWriter>::VisitCastExpr(const CastExpr *Node) {
   OF.emitTag("base_path");
   {
     auto I = Node->path_begin(), E = Node->path_end();
-    ArrayScope Scope(OF, std::distance(I, E));
+    TableScope Scope(OF, std::distance(I, E));
     for (; I != E; ++I) {
       dumpCXXBaseSpecifier(**I);
     }
@@ -2735,7 +4068,7 @@ void ASTExporter<ATDWriter>::VisitCastExpr(const CastExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ExplicitCastExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ExplicitCastExprTupleSize() {
   return CastExprTupleSize() + 1;
 }
 /// \atd
@@ -2747,7 +4080,7 @@ void ASTExporter<ATDWriter>::VisitExplicitCastExpr(const ExplicitCastExpr *Node)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::DeclRefExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::DeclRefExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2763,11 +4096,15 @@ void ASTExporter<ATDWriter>::VisitDeclRefExpr(const DeclRefExpr *Node) {
   const ValueDecl *D = Node->getDecl();
   const NamedDecl *FD = Node->getFoundDecl();
   bool HasFoundDeclRef = FD && D != FD;
-  ObjectScope Scope(OF, 0 + (bool) D + HasFoundDeclRef);
+  RecordFields<atd::decl_ref_expr_info> Fields;
+  Fields.set(atd::decl_ref_expr_info::decl_ref, D)
+        .set(atd::decl_ref_expr_info::found_decl_ref, HasFoundDeclRef);
+  ObjectScope Scope(OF, Fields);
 
   if (D) {
     OF.emitTag("decl_ref");
     dumpDeclRef(*D);
+    recordReferenceGraphEdge(ReferenceGraphEdge::Reference, D);
   }
   if (HasFoundDeclRef) {
     OF.emitTag("found_decl_ref");
@@ -2775,8 +4112,18 @@ void ASTExporter<ATDWriter>::VisitDeclRefExpr(const DeclRefExpr *Node) {
   }
 }
 
+/// Call expressions have no record of their own. Only the reference graph
+/// needs to know about them.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::VisitCallExpr(const CallExpr *Node) {
+  VisitExpr(Node);
+  if (const FunctionDecl *Callee = Node->getDirectCallee()) {
+    recordReferenceGraphEdge(ReferenceGraphEdge::Call, Callee);
+  }
+}
+
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::OverloadExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::OverloadExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2789,8 +4136,9 @@ template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitOverloadExpr(const OverloadExpr *Node) {
   VisitExpr(Node);
 
-  // suboptimal
-  ObjectScope Scope(OF, 2); // not covered by tests
+  RecordFields<atd::overload_expr_info> Fields;
+  Fields.set(atd::overload_expr_info::decls, Node->getNumDecls() > 0);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   {
     if (Node->getNumDecls() > 0) {
@@ -2806,7 +4154,7 @@ void ASTExporter<ATDWriter>::VisitOverloadExpr(const OverloadExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::UnresolvedLookupExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::UnresolvedLookupExprTupleSize() {
   return OverloadExprTupleSize() + 1;
 }
 /// \atd
@@ -2823,7 +4171,11 @@ void ASTExporter<ATDWriter>::VisitUnresolvedLookupExpr(const UnresolvedLookupExp
   bool RequiresADL = Node->requiresADL();
   bool IsOverloaded = Node->isOverloaded();
   bool HasNamingClass = Node->getNamingClass();
-  ObjectScope Scope(OF, 0 + RequiresADL + IsOverloaded + HasNamingClass); // not covered by tests
+  RecordFields<atd::unresolved_lookup_expr_info> Fields;
+  Fields.set(atd::unresolved_lookup_expr_info::requires_ADL, RequiresADL)
+        .set(atd::unresolved_lookup_expr_info::is_overloaded, IsOverloaded)
+        .set(atd::unresolved_lookup_expr_info::naming_class, HasNamingClass);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitFlag("requires_ADL", RequiresADL);
   OF.emitFlag("is_overloaded", IsOverloaded);
@@ -2834,7 +4186,7 @@ void ASTExporter<ATDWriter>::VisitUnresolvedLookupExpr(const UnresolvedLookupExp
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCIvarRefExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCIvarRefExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2849,17 +4201,20 @@ void ASTExporter<ATDWriter>::VisitObjCIvarRefExpr(const ObjCIvarRefExpr *Node) {
   VisitExpr(Node);
 
   bool IsFreeIvar = Node->isFreeIvar();
-  ObjectScope Scope(OF, 2 + IsFreeIvar); // not covered by tests
+  RecordFields<atd::obj_c_ivar_ref_expr_info> Fields;
+  Fields.set(atd::obj_c_ivar_ref_expr_info::is_free_ivar, IsFreeIvar);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("decl_ref");
   dumpDeclRef(*Node->getDecl());
   OF.emitTag("pointer");
   dumpPointer(Node->getDecl());
   OF.emitFlag("is_free_ivar", IsFreeIvar);
+  recordReferenceGraphEdge(ReferenceGraphEdge::Reference, Node->getDecl());
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::PredefinedExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::PredefinedExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2888,7 +4243,7 @@ void ASTExporter<ATDWriter>::VisitPredefinedExpr(const PredefinedExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CharacterLiteralTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CharacterLiteralTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2900,7 +4255,7 @@ void ASTExporter<ATDWriter>::VisitCharacterLiteral(const CharacterLiteral *Node)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::IntegerLiteralTupleSize() {
+constexpr int ASTExporter<ATDWriter>::IntegerLiteralTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2908,38 +4263,61 @@ int ASTExporter<ATDWriter>::IntegerLiteralTupleSize() {
 /// type integer_literal_info = {
 ///   ~is_signed : bool;
 ///   bitwidth : int;
-///   value : string;
+///   ~value : string;
+///   ?int_value : int option;
 /// } <ocaml field_prefix="ili_">
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitIntegerLiteral(const IntegerLiteral *Node) {
   VisitExpr(Node);
 
   bool IsSigned = Node->getType()->isSignedIntegerType();
-  ObjectScope Scope(OF, 2 + IsSigned);
+  const llvm::APInt &Value = Node->getValue();
+  // OCaml ints have 63 bits
+  bool IsNative = Options.nativeLiterals &&
+                  (IsSigned ? Value.getMinSignedBits() <= 63 : Value.getActiveBits() <= 62);
+  RecordFields<atd::integer_literal_info> Fields;
+  Fields.set(atd::integer_literal_info::is_signed, IsSigned)
+        .set(atd::integer_literal_info::value, !IsNative)
+        .set(atd::integer_literal_info::int_value, IsNative);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_signed", IsSigned);
   OF.emitTag("bitwidth");
-  OF.emitInteger(Node->getValue().getBitWidth());
-  OF.emitTag("value");
-  OF.emitString(Node->getValue().toString(10, IsSigned));
+  OF.emitInteger(Value.getBitWidth());
+  if (IsNative) {
+    OF.emitTag("int_value");
+    OF.emitVarInteger(IsSigned ? Value.getSExtValue() : (int64_t) Value.getZExtValue());
+  } else {
+    OF.emitTag("value");
+    OF.emitString(Value.toString(10, IsSigned));
+  }
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::FloatingLiteralTupleSize() {
+constexpr int ASTExporter<ATDWriter>::FloatingLiteralTupleSize() {
   return ExprTupleSize() + 1;
 }
+/// With NATIVE_LITERALS, single and double precision literals are dumped as
+/// NativeFloatingLiteral statements instead (see dumpStmt), whose value is a
+/// float. Other values keep their decimal representation.
 /// \atd
 /// #define floating_literal_tuple expr_tuple * string
+/// #define native_floating_literal_tuple expr_tuple * float
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::VisitFloatingLiteral(const FloatingLiteral *Node) {
   VisitExpr(Node);
+  double Value;
+  if (Options.nativeLiterals && getNativeFloatValue(Node, Value)) {
+    OF.emitFloat(Value);
+    return;
+  }
   llvm::SmallString<20> buf;
   Node->getValue().toString(buf);
   OF.emitString(buf.str());
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::StringLiteralTupleSize() {
+constexpr int ASTExporter<ATDWriter>::StringLiteralTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2951,7 +4329,7 @@ void ASTExporter<ATDWriter>::VisitStringLiteral(const StringLiteral *Str) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::UnaryOperatorTupleSize() {
+constexpr int ASTExporter<ATDWriter>::UnaryOperatorTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -2980,7 +4358,9 @@ void ASTExporter<ATDWriter>::VisitUnaryOperator(const UnaryOperator *Node) {
   VisitExpr(Node);
 
   bool IsPostfix = Node->isPostfix();
-  ObjectScope Scope(OF, 1 + IsPostfix);
+  RecordFields<atd::unary_operator_info> Fields;
+  Fields.set(atd::unary_operator_info::is_postfix, IsPostfix);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("kind");
   switch (Node->getOpcode()) {
@@ -3002,7 +4382,7 @@ void ASTExporter<ATDWriter>::VisitUnaryOperator(const UnaryOperator *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::UnaryExprOrTypeTraitExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::UnaryExprOrTypeTraitExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3019,7 +4399,9 @@ void ASTExporter<ATDWriter>::VisitUnaryExprOrTypeTraitExpr(
   VisitExpr(Node);
 
   bool HasQualType = Node->isArgumentType();
-  ObjectScope Scope(OF, 1 + HasQualType); // not covered by tests
+  RecordFields<atd::unary_expr_or_type_trait_expr_info> Fields;
+  Fields.set(atd::unary_expr_or_type_trait_expr_info::qual_type, HasQualType);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("kind");
   switch(Node->getKind()) {
@@ -3040,7 +4422,7 @@ void ASTExporter<ATDWriter>::VisitUnaryExprOrTypeTraitExpr(
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::MemberExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::MemberExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3055,7 +4437,9 @@ void ASTExporter<ATDWriter>::VisitMemberExpr(const MemberExpr *Node) {
   VisitExpr(Node);
 
   bool IsArrow = Node->isArrow();
-  ObjectScope Scope(OF, 2 + IsArrow);
+  RecordFields<atd::member_expr_info> Fields;
+  Fields.set(atd::member_expr_info::is_arrow, IsArrow);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_arrow", IsArrow);
   OF.emitTag("name");
@@ -3063,10 +4447,11 @@ void ASTExporter<ATDWriter>::VisitMemberExpr(const MemberExpr *Node) {
   dumpName(*memberDecl);
   OF.emitTag("decl_ref");
   dumpDeclRef(*memberDecl);
+  recordReferenceGraphEdge(ReferenceGraphEdge::Reference, memberDecl);
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ExtVectorElementExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ExtVectorElementExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3078,7 +4463,7 @@ void ASTExporter<ATDWriter>::VisitExtVectorElementExpr(const ExtVectorElementExp
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::BinaryOperatorTupleSize() {
+constexpr int ASTExporter<ATDWriter>::BinaryOperatorTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3163,7 +4548,7 @@ void ASTExporter<ATDWriter>::VisitBinaryOperator(const BinaryOperator *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CompoundAssignOperatorTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CompoundAssignOperatorTupleSize() {
   return BinaryOperatorTupleSize() + 1;
 }
 /// \atd
@@ -3183,7 +4568,7 @@ void ASTExporter<ATDWriter>::VisitCompoundAssignOperator(const CompoundAssignOpe
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::BlockExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::BlockExprTupleSize() {
   return ExprTupleSize() + DeclTupleSize();
 }
 /// \atd
@@ -3195,7 +4580,7 @@ void ASTExporter<ATDWriter>::VisitBlockExpr(const BlockExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::OpaqueValueExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::OpaqueValueExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3208,7 +4593,9 @@ void ASTExporter<ATDWriter>::VisitOpaqueValueExpr(const OpaqueValueExpr *Node) {
   VisitExpr(Node);
 
   const Expr *Source = Node->getSourceExpr();
-  ObjectScope Scope(OF, 0 + (bool) Source); // not covered by tests
+  RecordFields<atd::opaque_value_expr_info> Fields;
+  Fields.set(atd::opaque_value_expr_info::source_expr, Source);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   if (Source) {
     OF.emitTag("source_expr");
@@ -3219,7 +4606,7 @@ void ASTExporter<ATDWriter>::VisitOpaqueValueExpr(const OpaqueValueExpr *Node) {
 // GNU extensions.
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::AddrLabelExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::AddrLabelExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3243,7 +4630,7 @@ void ASTExporter<ATDWriter>::VisitAddrLabelExpr(const AddrLabelExpr *Node) {
 ////===----------------------------------------------------------------------===//
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXNamedCastExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXNamedCastExprTupleSize() {
   return ExplicitCastExprTupleSize() + 1;
 }
 /// \atd
@@ -3255,7 +4642,7 @@ void ASTExporter<ATDWriter>::VisitCXXNamedCastExpr(const CXXNamedCastExpr *Node)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXBoolLiteralExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXBoolLiteralExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3267,7 +4654,7 @@ void ASTExporter<ATDWriter>::VisitCXXBoolLiteralExpr(const CXXBoolLiteralExpr *N
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXConstructExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXConstructExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3283,17 +4670,21 @@ void ASTExporter<ATDWriter>::VisitCXXConstructExpr(const CXXConstructExpr *Node)
 
   bool IsElidable = Node->isElidable();
   bool RequiresZeroInitialization = Node->requiresZeroInitialization();
-  ObjectScope Scope(OF, 1 + IsElidable + RequiresZeroInitialization);
+  RecordFields<atd::cxx_construct_expr_info> Fields;
+  Fields.set(atd::cxx_construct_expr_info::is_elidable, IsElidable)
+        .set(atd::cxx_construct_expr_info::requires_zero_initialization, RequiresZeroInitialization);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("qual_type");
   CXXConstructorDecl *Ctor = Node->getConstructor();
   dumpQualType(Ctor->getType());
   OF.emitFlag("is_elidable", IsElidable);
   OF.emitFlag("requires_zero_initialization", RequiresZeroInitialization);
+  recordReferenceGraphEdge(ReferenceGraphEdge::Call, Ctor);
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXBindTemporaryExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXBindTemporaryExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3310,7 +4701,7 @@ void ASTExporter<ATDWriter>::VisitCXXBindTemporaryExpr(const CXXBindTemporaryExp
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::MaterializeTemporaryExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::MaterializeTemporaryExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3323,7 +4714,9 @@ void ASTExporter<ATDWriter>::VisitMaterializeTemporaryExpr(const MaterializeTemp
   VisitExpr(Node);
 
   const ValueDecl *VD = Node->getExtendingDecl();
-  ObjectScope Scope(OF, 0 + (bool) VD);
+  RecordFields<atd::materialize_temporary_expr_info> Fields;
+  Fields.set(atd::materialize_temporary_expr_info::decl_ref, VD);
+  ObjectScope Scope(OF, Fields);
   if (VD) {
     OF.emitTag("decl_ref");
     dumpDeclRef(*VD);
@@ -3331,7 +4724,7 @@ void ASTExporter<ATDWriter>::VisitMaterializeTemporaryExpr(const MaterializeTemp
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ExprWithCleanupsTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ExprWithCleanupsTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3345,7 +4738,9 @@ void ASTExporter<ATDWriter>::VisitExprWithCleanups(const ExprWithCleanups *Node)
   VisitExpr(Node);
 
   bool HasDeclRefs = Node->getNumObjects() > 0;
-  ObjectScope Scope(OF, 1 + HasDeclRefs);
+  RecordFields<atd::expr_with_cleanups_info> Fields;
+  Fields.set(atd::expr_with_cleanups_info::decl_refs, HasDeclRefs);
+  ObjectScope Scope(OF, Fields);
 
   if (HasDeclRefs) {
     OF.emitTag("decl_refs");
@@ -3365,7 +4760,7 @@ void ASTExporter<ATDWriter>::dumpCXXTemporary(const CXXTemporary *Temporary) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::LambdaExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::LambdaExprTupleSize() {
   return ExprTupleSize() + DeclTupleSize();
 }
 /// \atd
@@ -3377,7 +4772,7 @@ void ASTExporter<ATDWriter>::VisitLambdaExpr(const LambdaExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXNewExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXNewExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3394,7 +4789,11 @@ void ASTExporter<ATDWriter>::VisitCXXNewExpr(const CXXNewExpr *Node) {
   bool IsArray = Node->isArray();
   bool HasArraySize = Node->getArraySize();
   bool HasInitializer = Node->hasInitializer();
-  ObjectScope Scope(OF, 0 + IsArray + HasArraySize + HasInitializer);
+  RecordFields<atd::cxx_new_expr_info> Fields;
+  Fields.set(atd::cxx_new_expr_info::is_array, IsArray)
+        .set(atd::cxx_new_expr_info::array_size_expr, HasArraySize)
+        .set(atd::cxx_new_expr_info::initializer_expr, HasInitializer);
+  ObjectScope Scope(OF, Fields);
 
   ///  ?should_null_check : bool;
   //OF.emitFlag("should_null_check", Node->shouldNullCheckAllocation());
@@ -3410,7 +4809,7 @@ void ASTExporter<ATDWriter>::VisitCXXNewExpr(const CXXNewExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::CXXDeleteExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::CXXDeleteExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3423,7 +4822,9 @@ void ASTExporter<ATDWriter>::VisitCXXDeleteExpr(const CXXDeleteExpr *Node) {
   VisitExpr(Node);
 
   bool IsArray = Node->isArrayForm();
-  ObjectScope Scope(OF, 0 + IsArray);
+  RecordFields<atd::cxx_delete_expr_info> Fields;
+  Fields.set(atd::cxx_delete_expr_info::is_array, IsArray);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitFlag("is_array", IsArray);
 }
@@ -3432,7 +4833,7 @@ void ASTExporter<ATDWriter>::VisitCXXDeleteExpr(const CXXDeleteExpr *Node) {
 ////===----------------------------------------------------------------------===//
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCMessageExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCMessageExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3456,27 +4857,24 @@ void ASTExporter<ATDWriter>::VisitObjCMessageExpr(const ObjCMessageExpr *Node) {
   const Selector selector = Node->getSelector();
   const ObjCMethodDecl *m_decl = NULL;
   if (receiver) {
-    bool IsInst = Node->isInstanceMessage();
-    m_decl = receiver->lookupPrivateMethod(selector, IsInst);
-    // Look for definition first. It's possible that class redefines it without
-    // redeclaring. It needs to be defined in same translation unit to work.
-    if (m_decl) {
-      IsDefinitionFound = true;
-    } else {
-      // As a fallback look through method declarations in the interface.
-      // It's not very reliable (subclass might have redefined it)
-      // but it's better than nothing
-      IsDefinitionFound = false;
-      m_decl = receiver->lookupMethod(selector, IsInst);
-    }
+    ResolvedMethod Method = resolveMethod(*receiver, selector, Node->isInstanceMessage());
+    m_decl = Method.Decl;
+    IsDefinitionFound = Method.IsDefinitionFound;
   }
   ObjCMessageExpr::ReceiverKind RK = Node->getReceiverKind();
   bool HasNonDefaultReceiverKind = RK != ObjCMessageExpr::Instance;
-  ObjectScope Scope(OF, 1 + IsDefinitionFound + (bool) m_decl + HasNonDefaultReceiverKind);
+  RecordFields<atd::obj_c_message_expr_info> Fields;
+  Fields.set(atd::obj_c_message_expr_info::is_definition_found, IsDefinitionFound)
+        .set(atd::obj_c_message_expr_info::decl_pointer, m_decl)
+        .set(atd::obj_c_message_expr_info::receiver_kind, HasNonDefaultReceiverKind);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("selector");
-  OF.emitString(selector.getAsString());
-
+  StringRef SelectorName = printSelector(selector);
+  emitString(SelectorName);
+  if (ShouldRecordReferenceGraph) {
+    recordReferenceGraphEdge(ReferenceGraphEdge::Call, m_decl, SelectorName);
+  }
 
   if (m_decl) {
     OF.emitFlag("is_definition_found", IsDefinitionFound);
@@ -3506,15 +4904,40 @@ void ASTExporter<ATDWriter>::VisitObjCMessageExpr(const ObjCMessageExpr *Node) {
   }
 }
 
+template <class ATDWriter>
+typename ASTExporter<ATDWriter>::ResolvedMethod
+ASTExporter<ATDWriter>::resolveMethod(const ObjCInterfaceDecl &Receiver, Selector Sel, bool IsInst) {
+  Profile.methodLookups++;
+  auto Inserted = MethodLookups[IsInst].insert(std::make_pair(std::make_pair(&Receiver, Sel), ResolvedMethod()));
+  ResolvedMethod &Method = Inserted.first->second;
+  if (!Inserted.second) {
+    Profile.methodLookupCacheHits++;
+    return Method;
+  }
+  Method.Decl = Receiver.lookupPrivateMethod(Sel, IsInst);
+  // Look for definition first. It's possible that class redefines it without
+  // redeclaring. It needs to be defined in same translation unit to work.
+  if (Method.Decl) {
+    Method.IsDefinitionFound = true;
+  } else {
+    // As a fallback look through method declarations in the interface.
+    // It's not very reliable (subclass might have redefined it)
+    // but it's better than nothing
+    Method.IsDefinitionFound = false;
+    Method.Decl = Receiver.lookupMethod(Sel, IsInst);
+  }
+  return Method;
+}
+
 /// \atd
 /// type selector = string
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpSelector(const Selector sel) {
-  OF.emitString(sel.getAsString());
+  emitString(printSelector(sel));
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCBoxedExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCBoxedExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3526,7 +4949,7 @@ void ASTExporter<ATDWriter>::VisitObjCBoxedExpr(const ObjCBoxedExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCAtCatchStmtTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCAtCatchStmtTupleSize() {
   return StmtTupleSize() + 1;
 }
 /// \atd
@@ -3547,7 +4970,7 @@ void ASTExporter<ATDWriter>::VisitObjCAtCatchStmt(const ObjCAtCatchStmt *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCEncodeExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCEncodeExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3559,7 +4982,7 @@ void ASTExporter<ATDWriter>::VisitObjCEncodeExpr(const ObjCEncodeExpr *Node) {
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCSelectorExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCSelectorExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3571,7 +4994,7 @@ void ASTExporter<ATDWriter>::VisitObjCSelectorExpr(const ObjCSelectorExpr *Node)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCProtocolExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCProtocolExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3583,7 +5006,7 @@ void ASTExporter<ATDWriter>::VisitObjCProtocolExpr(const ObjCProtocolExpr *Node)
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCPropertyRefExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCPropertyRefExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3613,7 +5036,11 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyRefExpr(const ObjCPropertyRefExpr
   bool IsSuperReceiver = Node->isSuperReceiver();
   bool IsMessagingGetter = Node->isMessagingGetter();
   bool IsMessagingSetter = Node->isMessagingSetter();
-  ObjectScope Scope(OF, 1 + IsSuperReceiver + IsMessagingGetter + IsMessagingSetter); // not covered by tests
+  RecordFields<atd::obj_c_property_ref_expr_info> Fields;
+  Fields.set(atd::obj_c_property_ref_expr_info::is_super_receiver, IsSuperReceiver)
+        .set(atd::obj_c_property_ref_expr_info::is_messaging_getter, IsMessagingGetter)
+        .set(atd::obj_c_property_ref_expr_info::is_messaging_setter, IsMessagingSetter);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("kind");
   if (Node->isImplicitProperty()) {
@@ -3621,7 +5048,10 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyRefExpr(const ObjCPropertyRefExpr
     {
       bool HasImplicitPropertyGetter = Node->getImplicitPropertyGetter();
       bool HasImplicitPropertySetter = Node->getImplicitPropertySetter();
-      ObjectScope Scope(OF, 0 + HasImplicitPropertyGetter + HasImplicitPropertySetter);
+      RecordFields<atd::obj_c_method_ref_info> Fields;
+      Fields.set(atd::obj_c_method_ref_info::getter, HasImplicitPropertyGetter)
+            .set(atd::obj_c_method_ref_info::setter, HasImplicitPropertySetter);
+      ObjectScope Scope(OF, Fields);
 
       if (HasImplicitPropertyGetter) {
         OF.emitTag("getter");
@@ -3642,7 +5072,7 @@ void ASTExporter<ATDWriter>::VisitObjCPropertyRefExpr(const ObjCPropertyRefExpr
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCSubscriptRefExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCSubscriptRefExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3662,7 +5092,10 @@ void ASTExporter<ATDWriter>::VisitObjCSubscriptRefExpr(const ObjCSubscriptRefExp
 
   bool HasGetter = Node->getAtIndexMethodDecl();
   bool HasSetter = Node->setAtIndexMethodDecl();
-  ObjectScope Scope(OF, 1 + HasGetter + HasSetter); // not covered by tests
+  RecordFields<atd::obj_c_subscript_ref_expr_info> Fields;
+  Fields.set(atd::obj_c_subscript_ref_expr_info::getter, HasGetter)
+        .set(atd::obj_c_subscript_ref_expr_info::setter, HasSetter);
+  ObjectScope Scope(OF, Fields); // not covered by tests
 
   OF.emitTag("kind");
   if (Node->isArraySubscriptRefExpr()) {
@@ -3681,7 +5114,7 @@ void ASTExporter<ATDWriter>::VisitObjCSubscriptRefExpr(const ObjCSubscriptRefExp
 }
 
 template <class ATDWriter>
-int ASTExporter<ATDWriter>::ObjCBoolLiteralExprTupleSize() {
+constexpr int ASTExporter<ATDWriter>::ObjCBoolLiteralExprTupleSize() {
   return ExprTupleSize() + 1;
 }
 /// \atd
@@ -3699,6 +5132,7 @@ void ASTExporter<ATDWriter>::VisitObjCBoolLiteralExpr(const ObjCBoolLiteralExpr
 #define STMT(CLASS, PARENT) ///   | CLASS of (@CLASS@_tuple)
 #define ABSTRACT_STMT(STMT)
 #include <clang/AST/StmtNodes.inc>
+///   | NativeFloatingLiteral of (native_floating_literal_tuple)
 /// ] <ocaml repr="classic" validator="Clang_ast_visit.visit_stmt">
 
 //===----------------------------------------------------------------------===//
@@ -3909,9 +5343,17 @@ void ASTExporter<ATDWriter>::dumpType(const Type *T) {
 template <class ATDWriter>
 void ASTExporter<ATDWriter>::dumpPointerToType(const QualType &qt) {
   const Type *T = qt.getTypePtrOrNull();
+  noteReferencedType(T);
   dumpPointer(T);
 }
 
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::noteReferencedType(const Type *T) {
+  if (ShouldListReferencedTypes && T && ReferencedTypeSet.insert(T).second) {
+    ReferencedTypes.push_back(T);
+  }
+}
+
 /// \atd
 /// #define type_tuple type_info
 /// type type_info = {
@@ -3925,7 +5367,9 @@ void ASTExporter<ATDWriter>::VisitType(const Type *T) {
   // NOTE: T can (and will) be null here!!
 
   bool HasDesugaredType = T && T->getUnqualifiedDesugaredType() != T;
-  ObjectScope Scope(OF, 2 + HasDesugaredType);
+  RecordFields<atd::type_info> Fields;
+  Fields.set(atd::type_info::desugared_type, HasDesugaredType);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("pointer");
   dumpPointer(T);
@@ -3933,7 +5377,7 @@ void ASTExporter<ATDWriter>::VisitType(const Type *T) {
   OF.emitTag("raw");
 
   QualType qt(T, 0);
-  OF.emitString(qt.getAsString());
+  emitString(printType(qt.split()));
 
   if (HasDesugaredType) {
     OF.emitTag("desugared_type");
@@ -4036,7 +5480,9 @@ void ASTExporter<ATDWriter>::VisitFunctionProtoType(const FunctionProtoType *T)
   VisitFunctionType(T);
 
   bool HasParamsType = T->getNumParams() > 0;
-  ObjectScope Scope(OF, 0 + HasParamsType);
+  RecordFields<atd::params_type_info> Fields;
+  Fields.set(atd::params_type_info::params_type, HasParamsType);
+  ObjectScope Scope(OF, Fields);
 
   if (HasParamsType) {
     OF.emitTag("params_type");
@@ -4075,7 +5521,9 @@ void ASTExporter<ATDWriter>::VisitObjCObjectType(const ObjCObjectType *T) {
 
   int numProtocols = T->getNumProtocols();
   bool HasProtocols = numProtocols > 0;
-  ObjectScope Scope(OF, 1 + HasProtocols);
+  RecordFields<atd::objc_object_type_info> Fields;
+  Fields.set(atd::objc_object_type_info::protocol_decls_ptr, HasProtocols);
+  ObjectScope Scope(OF, Fields);
 
   OF.emitTag("base_type");
   dumpPointerToType(T->getBaseType());
@@ -4159,4 +5607,921 @@ TYPE(None, Type)
 #include <clang/AST/TypeNodes.def>
 /// ] <ocaml repr="classic" validator="Clang_ast_visit.visit_type">
 
+//===----------------------------------------------------------------------===//
+//  Declaration index
+//===----------------------------------------------------------------------===//
+
+/// \atd
+/// type byte_range = {
+///   offset : int;
+///   length : int
+/// } <ocaml field_prefix="br_">
+template <class ATDWriter>
+void writeByteRange(ATDWriter &OF, ByteRange R) {
+  typename ATDWriter::ObjectScope Scope(OF, 2);
+  OF.emitTag("offset");
+  OF.emitLongInteger(R.Offset);
+  OF.emitTag("length");
+  OF.emitLongInteger(R.Length);
+}
+
+/// \atd
+/// type decl_index = {
+///   decls : decl_index_entry list;
+///   types : byte_range
+/// } <ocaml field_prefix="dix_">
+///
+/// type decl_index_entry = {
+///   pointer : pointer;
+///   kind : decl_kind;
+///   ?qual_name : string list option;
+///   range : byte_range
+/// } <ocaml field_prefix="die_">
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpDeclIndex(raw_ostream &IndexOS) {
+  // The index is always written in Json (or Yojson) so that it can be read
+  // independently of the format of the main output.
+  JsonWriter W(IndexOS, Options.atdWriterOptions);
+  JsonWriter::ObjectScope Scope(W, 2);
+  W.emitTag("decls");
+  {
+    JsonWriter::ArrayScope Scope(W, declIndex.size());
+    for (const auto &Entry : declIndex) {
+      const Decl *D = Entry.first;
+      const NamedDecl *ND = dyn_cast<NamedDecl>(D);
+      RecordFields<atd::decl_index_entry> Fields;
+      Fields.set(atd::decl_index_entry::qual_name, ND);
+      JsonWriter::ObjectScope Scope(W, Fields);
+      W.emitTag("pointer");
+      writePointer(W, Options.withPointers, D);
+      W.emitTag("kind");
+      W.emitSimpleVariant(D->getDeclKindName());
+      if (ND) {
+        W.emitTag("qual_name");
+        ArenaVector<StringRef> splitted = splitQualifiedName(*ND, Arena);
+        JsonWriter::ArrayScope aScope(W, splitted.size());
+        // same order as in named_decl_info
+        for (int i = splitted.size() - 1; i >= 0; i--) {
+          W.emitString(splitted[i].data(), splitted[i].size());
+        }
+      }
+      W.emitTag("range");
+      writeByteRange(W, Entry.second);
+    }
+  }
+  W.emitTag("types");
+  writeByteRange(W, typesRange);
+}
+
+//===----------------------------------------------------------------------===//
+//  Compact field IDs
+//===----------------------------------------------------------------------===//
+
+/// With COMPACT_FIELD_IDS, the AST is preceded by this header record, which
+/// is written with the field names. The ID of a field is its index in
+/// fields. The schema version changes with the list of fields.
+/// \atd
+/// type field_ids_header = {
+///   compact_field_ids : int;
+///   schema_version : string;
+///   fields : string list
+/// } <ocaml field_prefix="fih_">
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpFieldIdsHeader() {
+  JsonWriter W(OS, Options.atdWriterOptions);
+  JsonWriter::ObjectScope Scope(W, 3);
+  // version of the dialect
+  W.emitTag("compact_field_ids");
+  W.emitInteger(1);
+  W.emitTag("schema_version");
+  W.emitString(atd::SchemaVersion);
+  W.emitTag("fields");
+  size_t NumFields = sizeof(atd::FieldNames) / sizeof(atd::FieldNames[0]);
+  JsonWriter::ArrayScope aScope(W, NumFields);
+  for (size_t I = 0; I < NumFields; I++) {
+    W.emitString(atd::FieldNames[I]);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  Sharding
+//===----------------------------------------------------------------------===//
+
+/// Assign a top-level declaration to a shard. The hash (FNV-1a) only depends
+/// on the kind and qualified name of the declaration, or on its location for
+/// unnamed declarations, so that the split is stable across runs.
+template <class ATDWriter>
+unsigned ASTExporter<ATDWriter>::shardOfDecl(const Decl &D) {
+  uint32_t Hash = 2166136261u;
+  auto Mix = [&Hash](const std::string &Str) {
+    for (char C : Str) {
+      Hash ^= (uint8_t) C;
+      Hash *= 16777619u;
+    }
+  };
+  Mix(D.getDeclKindName());
+  const NamedDecl *ND = dyn_cast<NamedDecl>(&D);
+  if (ND && ND->getDeclName()) {
+    Mix(ND->getQualifiedNameAsString());
+  } else {
+    PresumedLoc PLoc = SM.getPresumedLoc(SM.getSpellingLoc(D.getLocation()));
+    if (PLoc.isValid()) {
+      Mix(Options.normalizeSourcePath(PLoc.getFilename()));
+      Mix(std::to_string(PLoc.getLine()));
+      Mix(std::to_string(PLoc.getColumn()));
+    }
+  }
+  return Hash % NumShards;
+}
+
+struct ShardInfo {
+  std::string file;
+  std::string declIndexFile;
+  unsigned declCount;
+};
+
+/// \atd
+/// type shard_manifest = {
+///   shards : shard_info list
+/// } <ocaml field_prefix="smf_">
+///
+/// type shard_info = {
+///   file : string;
+///   ?decl_index_file : string option;
+///   decl_count : int;
+///   ~has_types : bool
+/// } <ocaml field_prefix="shi_">
+static void writeShardManifest(raw_ostream &ManifestOS,
+                               const ATDWriter::ATDWriterOptions &Opts,
+                               const std::vector<ShardInfo> &Shards) {
+  JsonWriter W(ManifestOS, Opts);
+  JsonWriter::ObjectScope Scope(W, 1);
+  W.emitTag("shards");
+  JsonWriter::ArrayScope aScope(W, Shards.size());
+  for (unsigned i = 0; i < Shards.size(); i++) {
+    const ShardInfo &Info = Shards[i];
+    bool HasIndex = Info.declIndexFile != "";
+    // types are only dumped in shard 0
+    bool HasTypes = i == 0;
+    RecordFields<atd::shard_info> Fields;
+    Fields.set(atd::shard_info::decl_index_file, HasIndex)
+          .set(atd::shard_info::has_types, HasTypes);
+    JsonWriter::ObjectScope Scope(W, Fields);
+    W.emitTag("file");
+    W.emitString(Info.file);
+    if (HasIndex) {
+      W.emitTag("decl_index_file");
+      W.emitString(Info.declIndexFile);
+    }
+    W.emitTag("decl_count");
+    W.emitInteger(Info.declCount);
+    W.emitFlag("has_types", HasTypes);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  Resource budgets
+//===----------------------------------------------------------------------===//
+
+/// Count a node against the budgets of the export. The clock is only read
+/// every 1024 nodes.
+template <class ATDWriter>
+typename ASTExporter<ATDWriter>::TruncationReason
+ASTExporter<ATDWriter>::consumeNodeBudget() {
+  if (ExhaustedBudget != NotTruncated) {
+    return ExhaustedBudget;
+  }
+  NumDumpedNodes++;
+  if (Options.maxNodes > 0 && NumDumpedNodes > Options.maxNodes) {
+    ExhaustedBudget = MaxNodesReached;
+  } else if (Options.maxOutputBytes > 0 && OS.tell() - StartOffset > Options.maxOutputBytes) {
+    ExhaustedBudget = MaxOutputBytesReached;
+  } else if (Options.maxExportSeconds > 0 && NumDumpedNodes % 1024 == 0) {
+    auto Elapsed = std::chrono::steady_clock::now() - StartTime;
+    if (Elapsed >= std::chrono::seconds(Options.maxExportSeconds)) {
+      ExhaustedBudget = MaxExportSecondsReached;
+    }
+  }
+  return ExhaustedBudget;
+}
+
+/// \atd
+/// type truncation = {
+///   kind : string;
+///   reason : truncation_reason
+/// } <ocaml field_prefix="trunc_">
+///
+/// type truncation_reason = [
+///   MaxNodes
+/// | MaxOutputBytes
+/// | MaxExportSeconds
+/// | MaxBodyNodes
+/// ]
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTruncation(const std::string &Kind, TruncationReason Reason) {
+  ObjectScope Scope(OF, 2);
+  OF.emitTag("kind");
+  OF.emitString(Kind);
+  OF.emitTag("reason");
+  switch (Reason) {
+  case MaxNodesReached:
+    OF.emitSimpleVariant("MaxNodes");
+    break;
+  case MaxOutputBytesReached:
+    OF.emitSimpleVariant("MaxOutputBytes");
+    break;
+  case MaxExportSecondsReached:
+    OF.emitSimpleVariant("MaxExportSeconds");
+    break;
+  case MaxBodyNodesReached:
+    OF.emitSimpleVariant("MaxBodyNodes");
+    break;
+  case NotTruncated:
+    llvm_unreachable("dumping the truncation of a node that was not truncated");
+  }
+}
+
+/// A truncated declaration is dumped as an EmptyDecl that keeps the pointer
+/// and the source range of the original declaration.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTruncatedDecl(const Decl &D, TruncationReason Reason) {
+  VariantScope Scope(OF, "EmptyDecl");
+  TupleScope Tuple(OF, ASTExporter::tupleSizeOfDeclKind(Decl::Empty));
+  RecordFields<atd::decl_info> Fields;
+  Fields.set(atd::decl_info::truncation);
+  ObjectScope Info(OF, Fields);
+  dumpStubDeclFields(D);
+  OF.emitTag("truncation");
+  dumpTruncation(std::string(D.getDeclKindName()) + "Decl", Reason);
+}
+
+/// The mandatory fields of the decl_info of a declaration dumped as an
+/// EmptyDecl in place of the original one.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpStubDeclFields(const Decl &D) {
+  OF.emitTag("pointer");
+  dumpPointer(&D);
+  OF.emitTag("source_range");
+  dumpSourceRange(D.getSourceRange());
+  OF.emitTag("attributes");
+  {
+    ArrayScope Scope(OF, 0);
+  }
+}
+
+/// A truncated statement is dumped as a NullStmt without children that keeps
+/// the pointer and the source range of the original statement.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpTruncatedStmt(const Stmt &S, TruncationReason Reason) {
+  VariantScope Scope(OF, "NullStmt");
+  TupleScope Tuple(OF, ASTExporter::tupleSizeOfStmtClass(Stmt::NullStmtClass));
+  {
+    RecordFields<atd::stmt_info> Fields;
+    Fields.set(atd::stmt_info::truncation);
+    ObjectScope Info(OF, Fields);
+    OF.emitTag("pointer");
+    dumpPointer(&S);
+    OF.emitTag("source_range");
+    dumpSourceRange(S.getSourceRange());
+    OF.emitTag("truncation");
+    dumpTruncation(S.getStmtClassName(), Reason);
+  }
+  {
+    ArrayScope Scope(OF, 0);
+  }
+}
+
+/// Number of statements in the tree rooted at S, counting at most Limit.
+static unsigned long countStmtNodes(const Stmt *S, unsigned long Limit) {
+  if (!S || Limit == 0) {
+    return 0;
+  }
+  unsigned long Count = 1;
+  for (Stmt::const_child_range CI = S->children(); CI && Count < Limit; ++CI) {
+    Count += countStmtNodes(*CI, Limit - Count);
+  }
+  return Count;
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpBody(const Decl &Owner, const Stmt *Body) {
+  // Blocks are nested in the bodies of their owners.
+  const Decl *OuterBodyOwner = BodyOwner;
+  BodyOwner = &Owner;
+  dumpBodyStmt(Body);
+  BodyOwner = OuterBodyOwner;
+}
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpBodyStmt(const Stmt *Body) {
+  unsigned long Limit = Options.maxBodyNodes;
+  if (Limit > 0 && countStmtNodes(Body, Limit + 1) > Limit) {
+    dumpTruncatedStmt(*Body, MaxBodyNodesReached);
+  } else {
+    dumpStmt(Body);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  Body fingerprints
+//===----------------------------------------------------------------------===//
+
+/// Structural hash (FNV-1a, 64 bits) of a statement tree. Source locations
+/// and pointers are ignored so that the hash is stable across runs and line
+/// shifts. Referenced declarations are identified by their qualified names,
+/// types by their spelling.
+class BodyHasher {
+  uint64_t Hash = 14695981039346656037ULL;
+
+  void mixBytes(const char *Data, size_t Size) {
+    for (size_t i = 0; i < Size; i++) {
+      Hash ^= (uint8_t) Data[i];
+      Hash *= 1099511628211ULL;
+    }
+  }
+
+  void mixInt(uint64_t X) {
+    for (int i = 0; i < 8; i++) {
+      uint8_t Byte = X >> (8 * i);
+      mixBytes((const char *) &Byte, 1);
+    }
+  }
+
+  void mixString(StringRef Str) {
+    mixInt(Str.size());
+    mixBytes(Str.data(), Str.size());
+  }
+
+  void mixDecl(const Decl *D) {
+    if (!D) {
+      mixInt(0);
+      return;
+    }
+    mixString(D->getDeclKindName());
+    if (const NamedDecl *ND = dyn_cast<NamedDecl>(D)) {
+      mixString(ND->getQualifiedNameAsString());
+    }
+    if (const ValueDecl *VD = dyn_cast<ValueDecl>(D)) {
+      mixString(VD->getType().getAsString());
+    }
+  }
+
+public:
+  void mixStmt(const Stmt *S) {
+    if (!S) {
+      mixInt(0);
+      return;
+    }
+    mixString(S->getStmtClassName());
+    if (const Expr *E = dyn_cast<Expr>(S)) {
+      mixString(E->getType().getAsString());
+    }
+    if (const DeclRefExpr *DRE = dyn_cast<DeclRefExpr>(S)) {
+      mixDecl(DRE->getDecl());
+    } else if (const MemberExpr *ME = dyn_cast<MemberExpr>(S)) {
+      mixDecl(ME->getMemberDecl());
+    } else if (const ObjCIvarRefExpr *IRE = dyn_cast<ObjCIvarRefExpr>(S)) {
+      mixDecl(IRE->getDecl());
+    } else if (const ObjCMessageExpr *OME = dyn_cast<ObjCMessageExpr>(S)) {
+      // Instance receivers are children, the others are types.
+      mixInt(OME->getReceiverKind());
+      switch (OME->getReceiverKind()) {
+      case ObjCMessageExpr::Instance:
+        break;
+      case ObjCMessageExpr::Class:
+        mixString(OME->getClassReceiver().getAsString());
+        break;
+      case ObjCMessageExpr::SuperClass:
+      case ObjCMessageExpr::SuperInstance:
+        mixString(OME->getSuperType().getAsString());
+        break;
+      }
+      mixString(OME->getSelector().getAsString());
+    } else if (const ObjCSelectorExpr *OSE = dyn_cast<ObjCSelectorExpr>(S)) {
+      mixString(OSE->getSelector().getAsString());
+    } else if (const CXXConstructExpr *CCE = dyn_cast<CXXConstructExpr>(S)) {
+      mixDecl(CCE->getConstructor());
+    } else if (const CXXBoolLiteralExpr *BLE = dyn_cast<CXXBoolLiteralExpr>(S)) {
+      mixInt(BLE->getValue());
+    } else if (const ObjCBoolLiteralExpr *OBLE = dyn_cast<ObjCBoolLiteralExpr>(S)) {
+      mixInt(OBLE->getValue());
+    } else if (const UnaryExprOrTypeTraitExpr *UETTE = dyn_cast<UnaryExprOrTypeTraitExpr>(S)) {
+      // Argument expressions are children, argument types are not.
+      mixInt(UETTE->getKind());
+      mixInt(UETTE->isArgumentType());
+      if (UETTE->isArgumentType()) {
+        mixString(UETTE->getArgumentType().getAsString());
+      }
+    } else if (const IntegerLiteral *IL = dyn_cast<IntegerLiteral>(S)) {
+      mixString(IL->getValue().toString(10, /*Signed=*/true));
+    } else if (const CharacterLiteral *CL = dyn_cast<CharacterLiteral>(S)) {
+      mixInt(CL->getValue());
+    } else if (const FloatingLiteral *FL = dyn_cast<FloatingLiteral>(S)) {
+      SmallString<32> Str;
+      FL->getValue().toString(Str);
+      mixString(Str);
+    } else if (const StringLiteral *SL = dyn_cast<StringLiteral>(S)) {
+      mixString(SL->getBytes());
+    } else if (const CompoundAssignOperator *CAO = dyn_cast<CompoundAssignOperator>(S)) {
+      mixInt(CAO->getOpcode());
+      mixString(CAO->getComputationLHSType().getAsString());
+      mixString(CAO->getComputationResultType().getAsString());
+    } else if (const BinaryOperator *BO = dyn_cast<BinaryOperator>(S)) {
+      mixInt(BO->getOpcode());
+    } else if (const UnaryOperator *UO = dyn_cast<UnaryOperator>(S)) {
+      mixInt(UO->getOpcode());
+    } else if (const CastExpr *CE = dyn_cast<CastExpr>(S)) {
+      mixInt(CE->getCastKind());
+    } else if (const DeclStmt *DS = dyn_cast<DeclStmt>(S)) {
+      for (auto I : DS->decls()) {
+        mixDecl(I);
+      }
+    } else if (const LabelStmt *LS = dyn_cast<LabelStmt>(S)) {
+      mixString(LS->getName());
+    } else if (const GotoStmt *GS = dyn_cast<GotoStmt>(S)) {
+      mixString(GS->getLabel()->getName());
+    } else if (const BlockExpr *BE = dyn_cast<BlockExpr>(S)) {
+      // The body of a block is not a child of the block expression.
+      mixStmt(BE->getBody());
+    }
+    mixInt(std::distance(S->child_begin(), S->child_end()));
+    for (Stmt::const_child_range CI = S->children(); CI; ++CI) {
+      mixStmt(*CI);
+    }
+  }
+
+  std::string getAsString() const {
+    char Buf[17];
+    snprintf(Buf, sizeof(Buf), "%016llx", (unsigned long long) Hash);
+    return Buf;
+  }
+};
+
+/// Names the functions, methods and blocks of the body hash manifest, and the
+/// functions and variables in declaration keys. Clang's USR generator is not
+/// available to plugins, so we use mangled names instead. Empty for other
+/// declarations.
+template <class ATDWriter>
+std::string ASTExporter<ATDWriter>::getMangledName(const Decl &D) {
+  if (!Mangler) {
+    Mangler.reset(D.getASTContext().createMangleContext());
+  }
+  std::string Name;
+  llvm::raw_string_ostream Out(Name);
+  if (const ObjCMethodDecl *MD = dyn_cast<ObjCMethodDecl>(&D)) {
+    Mangler->mangleObjCMethodName(MD, Out);
+  } else if (const BlockDecl *BD = dyn_cast<BlockDecl>(&D)) {
+    Mangler->mangleBlock(BD->getDeclContext(), BD, Out);
+  } else if (const FunctionDecl *FD = dyn_cast<FunctionDecl>(&D)) {
+    if (FD->isDependentContext() || !Mangler->shouldMangleDeclName(FD)) {
+      Out << FD->getQualifiedNameAsString();
+    } else if (const CXXConstructorDecl *CD = dyn_cast<CXXConstructorDecl>(FD)) {
+      Mangler->mangleCXXCtor(CD, Ctor_Complete, Out);
+    } else if (const CXXDestructorDecl *DD = dyn_cast<CXXDestructorDecl>(FD)) {
+      Mangler->mangleCXXDtor(DD, Dtor_Complete, Out);
+    } else {
+      Mangler->mangleName(FD, Out);
+    }
+  } else if (const VarDecl *VD = dyn_cast<VarDecl>(&D)) {
+    if (!VD->hasGlobalStorage() || VD->getDeclContext()->isDependentContext()
+        || !Mangler->shouldMangleDeclName(VD)) {
+      Out << VD->getQualifiedNameAsString();
+    } else {
+      Mangler->mangleName(VD, Out);
+    }
+  }
+  return Out.str();
+}
+
+/// Emit the body_hash field if requested (see shouldDumpBodyHash) and record
+/// the hash for the manifest.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpBodyHash(const Decl &D, const Stmt *Body) {
+  bool ShouldRecordBodyHash = Options.bodyHashManifest != "";
+  if (!shouldDumpBodyHash(Body) && !ShouldRecordBodyHash) {
+    return;
+  }
+  BodyHasher Hasher;
+  Hasher.mixStmt(Body);
+  std::string Hash = Hasher.getAsString();
+  if (ShouldRecordBodyHash) {
+    BodyHashes.push_back(BodyHashEntry{getMangledName(D), Hash});
+  }
+  if (shouldDumpBodyHash(Body)) {
+    OF.emitTag("body_hash");
+    OF.emitString(Hash);
+  }
+}
+
+/// \atd
+/// type export_profile = {
+///   dumped_nodes : int;
+///   method_lookups : int;
+///   method_lookup_cache_hits : int
+/// } <ocaml field_prefix="ep_">
+static void writeExportProfile(raw_ostream &ProfileOS,
+                               const ATDWriter::ATDWriterOptions &Opts,
+                               const ExportProfile &Profile) {
+  JsonWriter W(ProfileOS, Opts);
+  JsonWriter::ObjectScope Scope(W, 3);
+  W.emitTag("dumped_nodes");
+  W.emitLongInteger(Profile.dumpedNodes);
+  W.emitTag("method_lookups");
+  W.emitLongInteger(Profile.methodLookups);
+  W.emitTag("method_lookup_cache_hits");
+  W.emitLongInteger(Profile.methodLookupCacheHits);
+}
+
+/// \atd
+/// type body_hash_manifest = {
+///   bodies : body_hash_entry list
+/// } <ocaml field_prefix="bhm_">
+///
+/// type body_hash_entry = {
+///   name : string;
+///   hash : string
+/// } <ocaml field_prefix="bhe_">
+static void writeBodyHashManifest(raw_ostream &ManifestOS,
+                                  const ATDWriter::ATDWriterOptions &Opts,
+                                  const std::vector<BodyHashEntry> &Entries) {
+  JsonWriter W(ManifestOS, Opts);
+  JsonWriter::ObjectScope Scope(W, 1);
+  W.emitTag("bodies");
+  JsonWriter::ArrayScope aScope(W, Entries.size());
+  for (const BodyHashEntry &Entry : Entries) {
+    JsonWriter::ObjectScope Scope(W, 2);
+    W.emitTag("name");
+    W.emitString(Entry.name);
+    W.emitTag("hash");
+    W.emitString(Entry.hash);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  Imported declarations
+//===----------------------------------------------------------------------===//
+
+/// Key of a declaration in the exports made with DECL_KEYS, under which the
+/// exports of other TUs refer to it once imported. Unlike pointers, keys do
+/// not depend on the TU. A key is made of:
+/// - the kind of the declaration;
+/// - its mangled name if it has one, otherwise its qualified name, or its
+///   location for unnamed declarations;
+/// - the type of value declarations, which tells apart the overloads that
+///   are not mangled, e.g. in class templates;
+/// - the rank of the declaration in its redeclaration chain, if not the first.
+template <class ATDWriter>
+std::string ASTExporter<ATDWriter>::getDeclKey(const Decl &D) {
+  std::string Key = std::string(D.getDeclKindName()) + "Decl:";
+  const NamedDecl *ND = dyn_cast<NamedDecl>(&D);
+  if (ND && ND->getDeclName()) {
+    std::string MangledName = getMangledName(D);
+    Key += MangledName != "" ? MangledName : ND->getQualifiedNameAsString();
+  } else {
+    PresumedLoc PLoc = SM.getPresumedLoc(SM.getSpellingLoc(D.getLocation()));
+    if (PLoc.isValid()) {
+      Key += Options.normalizeSourcePath(PLoc.getFilename());
+      Key += ":" + std::to_string(PLoc.getLine()) + ":" + std::to_string(PLoc.getColumn());
+    }
+  }
+  if (const ValueDecl *VD = dyn_cast<ValueDecl>(&D)) {
+    Key += ":" + VD->getType().getAsString();
+  }
+  unsigned Rank = 0;
+  for (const Decl *Prev = D.getPreviousDecl(); Prev; Prev = Prev->getPreviousDecl()) {
+    Rank++;
+  }
+  if (Rank > 0) {
+    Key += "#" + std::to_string(Rank);
+  }
+  return Key;
+}
+
+/// A declaration deserialized from a module or a PCH is dumped as an
+/// EmptyDecl that keeps the pointer and the source range of the original
+/// declaration.
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpImportedDecl(const Decl &D) {
+  VariantScope Scope(OF, "EmptyDecl");
+  TupleScope Tuple(OF, ASTExporter::tupleSizeOfDeclKind(Decl::Empty));
+  RecordFields<atd::decl_info> Fields;
+  Fields.set(atd::decl_info::imported_decl);
+  ObjectScope Info(OF, Fields);
+  dumpStubDeclFields(D);
+  OF.emitTag("imported_decl");
+  dumpImportedDeclInfo(D);
+}
+
+/// Where to find an imported declaration: the declaration with the same key
+/// (see getDeclKey) in the export of its module, or of the prefix header for
+/// PCHs, which have no module name. Such exports are made once with DECL_KEYS.
+/// \atd
+/// type imported_decl = {
+///   ?module_name : string option;
+///   key : string
+/// } <ocaml field_prefix="idr_">
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::dumpImportedDeclInfo(const Decl &D) {
+  Module *M = D.getOwningModule();
+  RecordFields<atd::imported_decl> Fields;
+  Fields.set(atd::imported_decl::module_name, M);
+  ObjectScope Scope(OF, Fields);
+  if (M) {
+    OF.emitTag("module_name");
+    OF.emitString(M->getFullModuleName());
+  }
+  OF.emitTag("key");
+  emitString(getDeclKey(D));
+}
+
+//===----------------------------------------------------------------------===//
+//  Reference graph
+//===----------------------------------------------------------------------===//
+
+template <class ATDWriter>
+void ASTExporter<ATDWriter>::recordReferenceGraphEdge(ReferenceGraphEdge::Kind Kind,
+                                                      const Decl *To,
+                                                      const std::string &Selector) {
+  // Only the bodies of functions, methods and blocks are considered.
+  if (!ShouldRecordReferenceGraph || !BodyOwner) {
+    return;
+  }
+  ReferenceGraphEdge Edge{Kind, BodyOwner, To, Selector};
+  if (ReferenceGraphEdges.insert(Edge).second) {
+    ReferenceGraph.push_back(Edge);
+  }
+}
+
+/// The pointers of the reference graph are the ones of the main output, so
+/// the graph must be written after it. Edges are listed in order of first
+/// occurrence, so that the numbering of pointers does not depend on addresses.
+/// \atd
+/// type reference_graph = {
+///   edges : reference_graph_edge list
+/// } <ocaml field_prefix="rg_">
+///
+/// type reference_graph_edge = {
+///   kind : reference_graph_edge_kind;
+///   source : pointer;
+///   ?target : pointer option;
+///   ?selector : string option
+/// } <ocaml field_prefix="rge_">
+///
+/// type reference_graph_edge_kind = [ Call | Reference ]
+static void writeReferenceGraph(raw_ostream &GraphOS,
+                                const ASTExporterOptions &Options,
+                                const std::vector<ReferenceGraphEdge> &Edges) {
+  JsonWriter W(GraphOS, Options.atdWriterOptions);
+  JsonWriter::ObjectScope Scope(W, 1);
+  W.emitTag("edges");
+  JsonWriter::ArrayScope aScope(W, Edges.size());
+  for (const ReferenceGraphEdge &Edge : Edges) {
+    bool HasSelector = Edge.selector != "";
+    RecordFields<atd::reference_graph_edge> Fields;
+    Fields.set(atd::reference_graph_edge::target, Edge.to)
+          .set(atd::reference_graph_edge::selector, HasSelector);
+    JsonWriter::ObjectScope Scope(W, Fields);
+    W.emitTag("kind");
+    W.emitSimpleVariant(Edge.kind == ReferenceGraphEdge::Call ? "Call" : "Reference");
+    W.emitTag("source");
+    writePointer(W, Options.withPointers, Edge.from);
+    if (Edge.to) {
+      W.emitTag("target");
+      writePointer(W, Options.withPointers, Edge.to);
+    }
+    if (HasSelector) {
+      W.emitTag("selector");
+      W.emitString(Edge.selector);
+    }
+  }
+}
+
+/// Table of the declaration contexts referred to by named_decl_info records,
+/// written after the main output for the same reason as the reference graph.
+/// \atd
+/// type decl_contexts = {
+///   contexts : decl_context_name list
+/// } <ocaml field_prefix="dcs_">
+///
+/// type decl_context_name = {
+///   pointer : pointer;
+///   name : string;
+///   ?parent : pointer option
+/// } <ocaml field_prefix="dcn_">
+static void writeDeclContexts(raw_ostream &ContextsOS,
+                              const ASTExporterOptions &Options,
+                              const std::vector<DeclContextName> &Contexts) {
+  JsonWriter W(ContextsOS, Options.atdWriterOptions);
+  JsonWriter::ObjectScope Scope(W, 1);
+  W.emitTag("contexts");
+  JsonWriter::ArrayScope aScope(W, Contexts.size());
+  for (const DeclContextName &Context : Contexts) {
+    RecordFields<atd::decl_context_name> Fields;
+    Fields.set(atd::decl_context_name::parent, Context.parent);
+    JsonWriter::ObjectScope Scope(W, Fields);
+    W.emitTag("pointer");
+    writePointer(W, Options.withPointers, Context.context);
+    W.emitTag("name");
+    W.emitString(Context.name);
+    if (Context.parent) {
+      W.emitTag("parent");
+      writePointer(W, Options.withPointers, Context.parent);
+    }
+  }
+}
+
+//===----------------------------------------------------------------------===//
+//  Export of a translation unit
+//===----------------------------------------------------------------------===//
+
+/// Exports a whole translation unit, with its shards and its side outputs.
+/// Used by the plugin and by export_ast_file.
+template <
+  class ATDWriter=JsonWriter,
+  bool ForceYojson=false
+>
+class ExporterASTConsumer : public ASTConsumer {
+private:
+  ASTExporterOptions Options;
+  raw_ostream &OS;
+  std::vector<BodyHashEntry> BodyHashes;
+  std::vector<ReferenceGraphEdge> ReferenceGraph;
+  std::set<ReferenceGraphEdge> ReferenceGraphEdges;
+  ExportProfile Profile;
+  std::vector<DeclContextName> DeclContextNames;
+  std::unordered_set<const Decl*> NamedDeclContexts;
+
+public:
+  ExporterASTConsumer(ASTExporterOptions &&Opts, raw_ostream &OS)
+  : Options(std::move(Opts)), OS(OS)
+  {
+    if (ForceYojson) {
+      this->Options.atdWriterOptions.useYojson = true;
+    }
+  }
+
+  ExporterASTConsumer(const CompilerInstance &CI,
+                      std::unique_ptr<ASTExporterOptions> &&Opts,
+                      raw_ostream &OS)
+  : ExporterASTConsumer(std::move(*Opts), OS) {}
+
+  virtual void HandleTranslationUnit(ASTContext &Context) {
+    if (Options.deterministic) {
+      // Number the pointers of this translation unit from scratch.
+      pointerMap.clear();
+      pointerCounter = 0;
+    }
+    // Sharding requires named output files.
+    unsigned NumShards = Options.outputFile != "-" && Options.shards > 1 ? Options.shards : 1;
+    std::vector<ShardInfo> Shards;
+    for (unsigned Shard = 0; Shard < NumShards; Shard++) {
+      ShardInfo Info;
+      Info.file = ASTExporterOptions::shardFileName(Options.outputFile, Shard);
+      if (Options.declIndexFile != "") {
+        Info.declIndexFile = ASTExporterOptions::shardFileName(Options.declIndexFile, Shard);
+      }
+      if (Shard == 0) {
+        Info.declCount = exportShard(Context, OS, Info, Shard, NumShards);
+      } else {
+        std::error_code EC;
+        llvm::raw_fd_ostream ShardOS(Info.file, EC, llvm::sys::fs::F_None);
+        if (EC) {
+          llvm::errs() << "Failed to open shard file " << Info.file << ": " << EC.message() << "\n";
+          return;
+        }
+        Info.declCount = exportShard(Context, ShardOS, Info, Shard, NumShards);
+      }
+      Shards.push_back(Info);
+    }
+    if (NumShards > 1) {
+      // Shards are siblings of the manifest.
+      for (ShardInfo &Info : Shards) {
+        Info.file = llvm::sys::path::filename(Info.file);
+      }
+      std::string ManifestFile = Options.outputFile + ".manifest";
+      std::error_code EC;
+      llvm::raw_fd_ostream ManifestOS(ManifestFile, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        llvm::errs() << "Failed to open shard manifest " << ManifestFile << ": " << EC.message() << "\n";
+        return;
+      }
+      writeShardManifest(ManifestOS, Options.atdWriterOptions, Shards);
+    }
+    if (Options.bodyHashManifest != "") {
+      std::error_code EC;
+      llvm::raw_fd_ostream ManifestOS(Options.bodyHashManifest, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        llvm::errs() << "Failed to open body hash manifest " << Options.bodyHashManifest << ": " << EC.message() << "\n";
+        return;
+      }
+      writeBodyHashManifest(ManifestOS, Options.atdWriterOptions, BodyHashes);
+    }
+    if (Options.referenceGraphFile != "") {
+      std::error_code EC;
+      llvm::raw_fd_ostream GraphOS(Options.referenceGraphFile, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        llvm::errs() << "Failed to open reference graph file " << Options.referenceGraphFile << ": " << EC.message() << "\n";
+        return;
+      }
+      writeReferenceGraph(GraphOS, Options, ReferenceGraph);
+    }
+    if (Options.profileFile != "") {
+      std::error_code EC;
+      llvm::raw_fd_ostream ProfileOS(Options.profileFile, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        llvm::errs() << "Failed to open profile file " << Options.profileFile << ": " << EC.message() << "\n";
+        return;
+      }
+      writeExportProfile(ProfileOS, Options.atdWriterOptions, Profile);
+    }
+    if (Options.declContextsFile != "") {
+      std::error_code EC;
+      llvm::raw_fd_ostream ContextsOS(Options.declContextsFile, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        llvm::errs() << "Failed to open declaration contexts file " << Options.declContextsFile << ": " << EC.message() << "\n";
+        return;
+      }
+      writeDeclContexts(ContextsOS, Options, DeclContextNames);
+    }
+  }
+
+private:
+  // Returns the number of top-level declarations dumped in the shard.
+  unsigned exportShard(ASTContext &Context, raw_ostream &ShardOS, const ShardInfo &Info,
+                       unsigned Shard, unsigned NumShards) {
+    if (Options.extraOutputs.empty()) {
+      ASTExporter<ATDWriter> P(ShardOS, Context, Options, Shard, NumShards);
+      return dumpShard(Context, P, Info);
+    }
+    // The extra outputs are written by the same traversal. Their streams
+    // must outlive the exporter.
+    std::vector<std::unique_ptr<llvm::raw_fd_ostream>> ExtraStreams;
+    ASTExporter<TeeWriter> P(ShardOS, Context, Options, Shard, NumShards);
+    for (const ASTExporterOptions::ExtraOutput &Output : Options.extraOutputs) {
+      std::string File = ASTExporterOptions::shardFileName(Output.file, Shard);
+      bool IsBiniou = Output.format == "biniou";
+      std::error_code EC;
+      ExtraStreams.emplace_back(new llvm::raw_fd_ostream(
+        File, EC, IsBiniou ? llvm::sys::fs::F_None : llvm::sys::fs::F_Text));
+      if (EC) {
+        llvm::errs() << "Failed to open extra output file " << File << ": " << EC.message() << "\n";
+        ExtraStreams.pop_back();
+        continue;
+      }
+      if (IsBiniou) {
+        P.getWriter().addBiniouOutput(*ExtraStreams.back());
+      } else {
+        // Extra outputs keep the field names, e.g. to check the compact dialect.
+        ::ATDWriter::ATDWriterOptions WriterOptions = Options.atdWriterOptions;
+        WriterOptions.useYojson = Output.format == "yojson";
+        P.getWriter().addJsonOutput(*ExtraStreams.back(), WriterOptions);
+      }
+    }
+    return dumpShard(Context, P, Info);
+  }
+
+  template <class Exporter>
+  unsigned dumpShard(ASTContext &Context, Exporter &P, const ShardInfo &Info) {
+    P.dumpDecl(Context.getTranslationUnitDecl());
+    if (const char *Error = P.getWriter().validator().error()) {
+      llvm::errs() << "Malformed output " << Info.file << ": " << Error << "\n";
+    }
+    if (Info.declIndexFile != "") {
+      std::error_code EC;
+      llvm::raw_fd_ostream IndexOS(Info.declIndexFile, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        llvm::errs() << "Failed to open declaration index file " << Info.declIndexFile << ": " << EC.message() << "\n";
+      } else {
+        P.dumpDeclIndex(IndexOS);
+      }
+    }
+    const std::vector<BodyHashEntry> &ShardBodyHashes = P.getBodyHashes();
+    BodyHashes.insert(BodyHashes.end(), ShardBodyHashes.begin(), ShardBodyHashes.end());
+    for (const ReferenceGraphEdge &Edge : P.getReferenceGraph()) {
+      if (ReferenceGraphEdges.insert(Edge).second) {
+        ReferenceGraph.push_back(Edge);
+      }
+    }
+    Profile += P.getProfile();
+    // Shards share the same pointers, so contexts are listed once.
+    for (const DeclContextName &Context : P.getDeclContextNames()) {
+      if (NamedDeclContexts.insert(Context.context).second) {
+        DeclContextNames.push_back(Context);
+      }
+    }
+    return P.getNumTopLevelDecls();
+  }
+};
+
+
+//===----------------------------------------------------------------------===//
+//  Tuple size tables
+//===----------------------------------------------------------------------===//
+
+template <class Impl>
+constexpr int TupleSizeTables<Impl>::declKindTupleSizes[];
+
+template <class Impl>
+constexpr int TupleSizeTables<Impl>::stmtClassTupleSizes[];
+
 } // end of namespace ASTLib
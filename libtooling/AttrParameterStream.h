@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2015, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <clang/Basic/VersionTuple.h>
+#include <llvm/ADT/StringRef.h>
+
+namespace ASTLib {
+
+/// Receives the parameters of an attribute from the dumping code generated
+/// by clang (AttrDump.inc) and forwards each of them to Impl as a typed
+/// value. Separators are dropped on the fly, nothing is buffered.
+template <class Impl>
+class AttrParameterStreamBase {
+
+  Impl &impl() { return *static_cast<Impl*>(this); }
+
+public:
+  Impl &operator<<(llvm::StringRef Str) {
+    // AttrDump.inc separates parameters with " " and quotes string
+    // parameters with " \"" and "\"".
+    if (Str != " " && Str != " \"" && Str != "\"") {
+      impl().emitString(Str);
+    }
+    return impl();
+  }
+
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, Impl&>::type
+  operator<<(T X) {
+    impl().emitInteger(static_cast<int64_t>(X));
+    return impl();
+  }
+
+  Impl &operator<<(const clang::VersionTuple &Version) {
+    impl().emitVersion(Version);
+    return impl();
+  }
+
+};
+
+/// Counts the parameters of an attribute, e.g. to size the array that will
+/// receive them.
+class AttrParameterCounter : public AttrParameterStreamBase<AttrParameterCounter> {
+
+  unsigned Count = 0;
+
+public:
+  void emitString(llvm::StringRef) { Count++; }
+  void emitInteger(int64_t) { Count++; }
+  void emitVersion(const clang::VersionTuple &) { Count++; }
+  void emitUnknown() { Count++; }
+
+  unsigned getCount() const { return Count; }
+
+};
+
+/// Writes the parameters of an attribute directly to an ATDWriter.
+/// See the definition of the ATD type 'attribute_parameter' in ASTExporter.h.
+template <class ATDWriter>
+class AttrParameterEmitter : public AttrParameterStreamBase<AttrParameterEmitter<ATDWriter>> {
+
+  typedef typename ATDWriter::ObjectScope ObjectScope;
+  typedef typename ATDWriter::VariantScope VariantScope;
+
+  ATDWriter &OF;
+
+public:
+  AttrParameterEmitter(ATDWriter &OF) : OF(OF) {}
+
+  void emitString(llvm::StringRef Str) {
+    VariantScope Scope(OF, "String");
+    OF.emitString(Str.str());
+  }
+
+  void emitInteger(int64_t X) {
+    VariantScope Scope(OF, "Integer");
+    OF.emitLongInteger(X);
+  }
+
+  void emitVersion(const clang::VersionTuple &Version) {
+    VariantScope Scope(OF, "Version");
+    llvm::Optional<unsigned> Minor = Version.getMinor();
+    llvm::Optional<unsigned> Subminor = Version.getSubminor();
+    ObjectScope ObjScope(OF, 1 + Minor.hasValue() + Subminor.hasValue());
+    OF.emitTag("major");
+    OF.emitInteger(Version.getMajor());
+    if (Minor.hasValue()) {
+      OF.emitTag("minor");
+      OF.emitInteger(*Minor);
+    }
+    if (Subminor.hasValue()) {
+      OF.emitTag("subminor");
+      OF.emitInteger(*Subminor);
+    }
+  }
+
+  void emitUnknown() {
+    OF.emitSimpleVariant("Unknown");
+  }
+
+};
+
+} // end of namespace ASTLib
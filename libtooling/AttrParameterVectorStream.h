@@ -1,35 +0,0 @@
-/**
- * Copyright (c) 2015, Facebook, Inc.
- * All rights reserved.
- *
- * This source code is licensed under the BSD-style license found in the
- * LICENSE file in the root directory of this source tree. An additional grant
- * of patent rights can be found in the PATENTS file in the same directory.
- *
- */
-
-#pragma once
-
-#include <string>
-#include <vector>
-#include <clang/Basic/VersionTuple.h>
-
-namespace ASTLib {
-
-class AttrParameterVectorStream {
-
-private:
-  std::vector<std::string> Content;
-
-public:
-  AttrParameterVectorStream() {}
-
-  AttrParameterVectorStream &operator<<(const std::string &str);
-  AttrParameterVectorStream &operator<<(const unsigned int x);
-  AttrParameterVectorStream &operator<<(const clang::VersionTuple &verTup);
-
-  const std::vector<std::string> &getContent();
-
-};
-
-} // end of namespace ASTLib
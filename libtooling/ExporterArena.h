@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2015, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace ASTLib {
+
+/// Standard allocator drawing from a BumpPtrAllocator. Memory is only
+/// released when the arena is reset.
+template <class T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+
+  llvm::BumpPtrAllocator *Arena;
+
+  ArenaAllocator(llvm::BumpPtrAllocator &Arena) : Arena(&Arena) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &Other) : Arena(Other.Arena) {}
+
+  T *allocate(size_t N) { return Arena->Allocate<T>(N); }
+  void deallocate(T *, size_t) {}
+
+  template <class U>
+  bool operator==(const ArenaAllocator<U> &Other) const { return Arena == Other.Arena; }
+  template <class U>
+  bool operator!=(const ArenaAllocator<U> &Other) const { return Arena != Other.Arena; }
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+/// Prints a string into a BumpPtrAllocator. The result of str() is valid
+/// until the arena is reset.
+class ArenaStringOStream : public llvm::raw_ostream {
+  llvm::BumpPtrAllocator &Arena;
+  char *Data;
+  size_t Size;
+  size_t Capacity;
+
+  void write_impl(const char *Ptr, size_t Len) override {
+    if (Size + Len > Capacity) {
+      // The previous buffer is abandoned to the arena.
+      size_t NewCapacity = std::max(2 * Capacity, Size + Len);
+      char *NewData = Arena.Allocate<char>(NewCapacity);
+      memcpy(NewData, Data, Size);
+      Data = NewData;
+      Capacity = NewCapacity;
+    }
+    memcpy(Data + Size, Ptr, Len);
+    Size += Len;
+  }
+
+  uint64_t current_pos() const override { return Size; }
+
+public:
+  ArenaStringOStream(llvm::BumpPtrAllocator &Arena, size_t InitialCapacity = 64)
+    : llvm::raw_ostream(/*unbuffered=*/true), Arena(Arena),
+      Data(Arena.Allocate<char>(InitialCapacity)), Size(0), Capacity(InitialCapacity) {}
+
+  llvm::StringRef str() const { return llvm::StringRef(Data, Size); }
+};
+
+} // end of namespace ASTLib
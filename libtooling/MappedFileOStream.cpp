@@ -0,0 +1,148 @@
+/**
+ * Copyright (c) 2015, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Signals.h>
+
+#include "MappedFileOStream.h"
+
+namespace ASTPluginLib {
+
+  // The file grows by at least this many bytes at a time.
+  static const uint64_t chunkSize = 64 << 20;
+
+  MappedFileOStream::MappedFileOStream(const std::string &path, const std::string &tmpPath, bool removeFileOnSignal, int fd)
+    : llvm::raw_ostream(/*unbuffered=*/true),
+      path(path), tmpPath(tmpPath), removeFileOnSignal(removeFileOnSignal), fd(fd),
+      data(nullptr), size(0), capacity(0), hasError(false) { }
+
+  std::unique_ptr<MappedFileOStream> MappedFileOStream::create(const std::string &path,
+                                                               bool removeFileOnSignal,
+                                                               bool useTemporary,
+                                                               bool createMissingDirectories,
+                                                               std::string &error) {
+    if (createMissingDirectories) {
+      llvm::StringRef parent = llvm::sys::path::parent_path(path);
+      if (parent != "") {
+        if (std::error_code EC = llvm::sys::fs::create_directories(parent)) {
+          error = EC.message();
+          return nullptr;
+        }
+      }
+    }
+    int fd = -1;
+    std::string tmpPath;
+    if (useTemporary) {
+      llvm::SmallString<128> result;
+      if (std::error_code EC = llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%", fd, result)) {
+        error = EC.message();
+        return nullptr;
+      }
+      tmpPath = result.str();
+    } else {
+      fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+      if (fd < 0) {
+        error = strerror(errno);
+        return nullptr;
+      }
+    }
+    const std::string &openedPath = useTemporary ? tmpPath : path;
+    if (removeFileOnSignal) {
+      llvm::sys::RemoveFileOnSignal(openedPath);
+    }
+    return std::unique_ptr<MappedFileOStream>(new MappedFileOStream(path, tmpPath, removeFileOnSignal, fd));
+  }
+
+  MappedFileOStream::~MappedFileOStream() {
+    discard();
+  }
+
+  bool MappedFileOStream::grow(uint64_t minCapacity) {
+    uint64_t newCapacity = std::max(2 * capacity, (minCapacity + chunkSize - 1) / chunkSize * chunkSize);
+    if (!unmap() || ::ftruncate(fd, newCapacity) != 0) {
+      return false;
+    }
+    void *ptr = ::mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      return false;
+    }
+    data = static_cast<char *>(ptr);
+    capacity = newCapacity;
+    return true;
+  }
+
+  bool MappedFileOStream::unmap() {
+    if (data == nullptr) {
+      return true;
+    }
+    bool success = ::munmap(data, capacity) == 0;
+    data = nullptr;
+    capacity = 0;
+    return success;
+  }
+
+  void MappedFileOStream::write_impl(const char *ptr, size_t len) {
+    if (hasError) {
+      return;
+    }
+    if (size + len > capacity && !grow(size + len)) {
+      hasError = true;
+      return;
+    }
+    memcpy(data + size, ptr, len);
+    size += len;
+  }
+
+  bool MappedFileOStream::keep() {
+    if (fd < 0) {
+      return false;
+    }
+    flush();
+    hasError |= !unmap();
+    hasError |= ::ftruncate(fd, size) != 0;
+    hasError |= ::close(fd) != 0;
+    fd = -1;
+    const std::string &openedPath = tmpPath != "" ? tmpPath : path;
+    if (!hasError && tmpPath != "") {
+      hasError = (bool) llvm::sys::fs::rename(tmpPath, path);
+    }
+    if (hasError) {
+      llvm::sys::fs::remove(openedPath);
+    }
+    if (removeFileOnSignal) {
+      llvm::sys::DontRemoveFileOnSignal(openedPath);
+    }
+    return !hasError;
+  }
+
+  void MappedFileOStream::discard() {
+    if (fd < 0) {
+      return;
+    }
+    unmap();
+    ::close(fd);
+    fd = -1;
+    const std::string &openedPath = tmpPath != "" ? tmpPath : path;
+    llvm::sys::fs::remove(openedPath);
+    if (removeFileOnSignal) {
+      llvm::sys::DontRemoveFileOnSignal(openedPath);
+    }
+  }
+
+}
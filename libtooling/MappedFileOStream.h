@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2015, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+namespace ASTPluginLib {
+
+/**
+ * Output stream writing into a memory-mapped file. The file is grown and
+ * re-mapped in large chunks, so that writes are plain memory copies instead
+ * of system calls. The stream is unbuffered since the mapping already acts
+ * as a buffer.
+ *
+ * As with clang::CompilerInstance::createOutputFile, the data may be written
+ * to a temporary file first, and the file may be removed if the process is
+ * killed by a signal. Nothing is committed until keep() is called.
+ */
+class MappedFileOStream : public llvm::raw_ostream {
+  std::string path;
+  std::string tmpPath;
+  bool removeFileOnSignal;
+  int fd;
+  char *data;
+  uint64_t size;
+  uint64_t capacity;
+  bool hasError;
+
+  MappedFileOStream(const std::string &path, const std::string &tmpPath, bool removeFileOnSignal, int fd);
+
+  void write_impl(const char *ptr, size_t len) override;
+  uint64_t current_pos() const override { return size; }
+
+  bool grow(uint64_t minCapacity);
+  bool unmap();
+
+public:
+  /**
+   * Returns nullptr and sets error if the file cannot be created.
+   */
+  static std::unique_ptr<MappedFileOStream> create(const std::string &path,
+                                                   bool removeFileOnSignal,
+                                                   bool useTemporary,
+                                                   bool createMissingDirectories,
+                                                   std::string &error);
+
+  ~MappedFileOStream();
+
+  /**
+   * Truncates the file to the data written so far and moves it to its final
+   * path. Returns false if an error occurred at any point.
+   */
+  bool keep();
+
+  /**
+   * Removes the file. Also done when the stream is destroyed without keep().
+   */
+  void discard();
+
+};
+
+}
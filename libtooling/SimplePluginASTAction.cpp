@@ -107,6 +107,7 @@ namespace ASTPluginLib {
     loadString(map, "MAKE_RELATIVE_TO", repoRoot);
     loadBool(map, "KEEP_EXTERNAL_PATHS", keepExternalPaths);
     loadBool(map, "RESOLVE_SYMLINKS", resolveSymlinks);
+    loadBool(map, "MMAP_OUTPUT", mmapOutput);
 
     loadString(map, "USE_TEMP_DIR_FOR_DEDUPLICATION", tempDirDeduplication);
     loadString(map, "USE_TEMP_DIR_FOR_COPIED_PATHS", tempDirTranslation);
@@ -22,6 +22,7 @@
 
 #include "FileServices.h"
 #include "FileUtils.h"
+#include "MappedFileOStream.h"
 
 namespace ASTPluginLib {
 
@@ -44,6 +45,8 @@ struct PluginASTOptionsBase {
   bool keepExternalPaths = false;
   /* Resolve symlinks to their real path. */
   bool resolveSymlinks = false;
+  /* Write the output file through a memory mapping instead of a file stream. */
+  bool mmapOutput = false;
 
   /* Deduplication service: whether certain files should be visited once. */
   std::unique_ptr<FileServices::DeduplicationService> deduplicationService;
@@ -102,6 +105,43 @@ protected:
 
 };
 
+/* Owns the output stream of a MappedOutputASTConsumer. As the first base
+ * class, it is constructed before the consumer and destroyed after it. */
+struct MappedOutputHolder {
+  std::unique_ptr<MappedFileOStream> MappedOS;
+  std::string OutputFile;
+
+  MappedOutputHolder(std::unique_ptr<MappedFileOStream> &&OS, const std::string &OutputFile)
+  : MappedOS(std::move(OS)), OutputFile(OutputFile) {}
+};
+
+/* Consumer writing through a memory-mapped output file (MMAP_OUTPUT). The
+ * stream belongs to the consumer, since plugin actions added with -add-plugin
+ * are destroyed as soon as their consumer is created. */
+template <class T>
+class MappedOutputASTConsumer : private MappedOutputHolder, public T {
+  const clang::CompilerInstance &CI;
+
+public:
+  template <class PluginASTOptions>
+  MappedOutputASTConsumer(const clang::CompilerInstance &CI,
+                          std::unique_ptr<PluginASTOptions> &&Options,
+                          std::unique_ptr<MappedFileOStream> &&OS)
+  : MappedOutputHolder(std::move(OS), Options->outputFile),
+    T(CI, std::move(Options), *MappedOS),
+    CI(CI) {}
+
+  void HandleTranslationUnit(clang::ASTContext &Context) override {
+    T::HandleTranslationUnit(Context);
+    // Same policy as CompilerInstance::clearOutputFiles.
+    if (CI.getDiagnostics().hasErrorOccurred()) {
+      MappedOS->discard();
+    } else if (!MappedOS->keep()) {
+      llvm::errs() << "Failed to write output file " << OutputFile << "\n";
+    }
+  }
+};
+
 template <
   class T,
   class PluginASTOptions = PluginASTOptionsBase,
@@ -118,6 +158,22 @@ protected:
     Parent::Options->inputFile = inputFile;
     Parent::Options->setObjectFile(CI.getFrontendOpts().OutputFile);
 
+    if (Parent::Options->mmapOutput && Parent::Options->outputFile != "-") {
+      std::string Error;
+      std::unique_ptr<MappedFileOStream> MappedOS =
+        MappedFileOStream::create(Parent::Options->outputFile,
+                                  RemoveFileOnSignal,
+                                  UseTemporary,
+                                  CreateMissingDirectories,
+                                  Error);
+      if (!MappedOS) {
+        llvm::errs() << "Failed to open output file " << Parent::Options->outputFile << ": " << Error << "\n";
+        return nullptr;
+      }
+      return std::unique_ptr<clang::ASTConsumer>(
+        new MappedOutputASTConsumer<T>(CI, std::move(Parent::Options), std::move(MappedOS)));
+    }
+
     llvm::raw_fd_ostream *OS =
       CI.createOutputFile(Parent::Options->outputFile,
                           Binary,
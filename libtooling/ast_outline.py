@@ -0,0 +1,237 @@
+# Copyright (c) 2015, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree. An additional grant
+# of patent rights can be found in the PATENTS file in the same directory.
+
+from __future__ import print_function
+
+import sys
+import re
+import json
+import argparse
+import collections
+
+"""
+Print an outline of an AST exported by JsonASTExporter: one line per explicit
+declaration, indented by nesting, followed by the values of selected fields
+of the declaration. Pointers, locations and types pointers are left out so
+that the outline does not depend on the numbering of pointers.
+"""
+
+try:
+    string_types = (basestring,)
+except NameError:
+    string_types = (str,)
+
+simple_variant = re.compile(r'^[A-Z][A-Za-z0-9_]*$')
+
+# Fields of records that are left out of the outline.
+skipped_keys = set(["pointer", "parent_pointer", "source_range", "type_ptr"])
+
+
+def is_decl(value):
+    return (isinstance(value, list) and len(value) == 2
+            and isinstance(value[0], string_types) and value[0].endswith("Decl")
+            and isinstance(value[1], list) and len(value[1]) > 0
+            and isinstance(value[1][0], dict) and "pointer" in value[1][0])
+
+
+def is_comment(value):
+    return (isinstance(value, list) and len(value) == 2
+            and isinstance(value[0], string_types) and value[0].endswith("Comment")
+            and isinstance(value[1], list))
+
+
+def is_variant(value, key):
+    return (isinstance(value, list) and len(value) == 2
+            and isinstance(value[0], string_types) and simple_variant.match(value[0])
+            and key != "qual_name")
+
+
+def decl_name(decl):
+    name = ""
+    if len(decl[1]) > 1 and isinstance(decl[1][1], dict) and "name" in decl[1][1]:
+        info = decl[1][1]
+        if "qual_name" in info:
+            name = "::".join(reversed(info["qual_name"]))
+        else:
+            name = info["name"]
+    return decl[0] + (" " + name if name != "" else "")
+
+
+def comment_text(comment):
+    texts = []
+
+    def collect(value):
+        if is_comment(value):
+            if value[0] == "TextComment":
+                texts.append(value[1][2].strip())
+            for child in value[1][1]:
+                collect(child)
+    collect(comment)
+    return " ".join(t for t in texts if t != "")
+
+
+class Outline:
+
+    def __init__(self, fields, classes, module_keys):
+        self.fields = fields
+        self.classes = classes
+        # keys of the declarations of the modules, if given
+        self.module_keys = module_keys
+        # values of each class field, numbered in order of first appearance
+        self.class_ids = collections.defaultdict(dict)
+        self.names = {}
+
+    def collect_names(self, value):
+        if is_decl(value):
+            self.names[value[1][0]["pointer"]] = decl_name(value)
+        if isinstance(value, list):
+            for child in value:
+                self.collect_names(child)
+        elif isinstance(value, dict):
+            for child in value.values():
+                self.collect_names(child)
+
+    def render(self, value, key=None):
+        if isinstance(value, bool):
+            return "true" if value else "false"
+        if isinstance(value, string_types):
+            if (key == "template_decl" or (key or "").endswith("pointer")) and value in self.names:
+                return self.names[value]
+            if simple_variant.match(value):
+                return value
+            return json.dumps(value)
+        if isinstance(value, dict):
+            if key == "imported_decl" and self.module_keys is not None:
+                found = (value.get("module_name"), value["key"]) in self.module_keys
+                return "{%s (%s)}" % (", ".join(k + "=" + self.render(v, k) for (k, v) in value.items()),
+                                      "resolved" if found else "unresolved")
+            if "raw" in value and "type_ptr" in value:
+                # qual_type
+                return json.dumps(value["raw"])
+            if "decl_pointer" in value:
+                # decl_ref
+                rendered = value["kind"] + "Decl"
+                if "name" in value:
+                    rendered += " " + "::".join(reversed(value["name"].get("qual_name", [value["name"]["name"]])))
+                return rendered
+            return "{" + ", ".join(k + "=" + self.render(v, k)
+                                   for (k, v) in value.items() if k not in skipped_keys) + "}"
+        if isinstance(value, list):
+            if is_decl(value):
+                return "<" + decl_name(value) + ">"
+            if is_comment(value):
+                return json.dumps(comment_text(value))
+            if is_variant(value, key):
+                return value[0] + " " + self.render(value[1], key)
+            return "[" + ", ".join(self.render(v, key) for v in value) + "]"
+        return json.dumps(value)
+
+    def find_fields(self, value, found):
+        """Fields of a declaration, without those of nested declarations."""
+        if isinstance(value, dict):
+            for (k, v) in value.items():
+                if k in self.fields or k in self.classes:
+                    found.append((k, v))
+                else:
+                    self.find_fields(v, found)
+        elif isinstance(value, list) and not is_decl(value):
+            for child in value:
+                self.find_fields(child, found)
+
+    def render_field(self, key, value):
+        if key in self.classes:
+            rendered = self.render(value, key)
+            ids = self.class_ids[key]
+            if rendered not in ids:
+                ids[rendered] = len(ids) + 1
+            return "#%d" % ids[rendered]
+        return self.render(value, key)
+
+    def print_decls(self, value, depth):
+        if is_decl(value):
+            if value[1][0].get("is_implicit", False):
+                return
+            found = []
+            for child in value[1]:
+                self.find_fields(child, found)
+            line = "  " * depth + decl_name(value)
+            for (k, v) in found:
+                line += " " + k + "=" + self.render_field(k, v)
+            print(line)
+            for child in value[1]:
+                self.print_decls(child, depth + 1)
+        elif isinstance(value, list):
+            for child in value:
+                self.print_decls(child, depth)
+        elif isinstance(value, dict):
+            for child in value.values():
+                self.print_decls(child, depth)
+
+
+def print_references(outline, graph):
+    """Edges of a reference graph made with REFERENCE_GRAPH_FILE, with the declarations
+    of the export named after their pointers ('?' for pointers missing from the export)."""
+    for edge in graph["edges"]:
+        line = edge["kind"] + " " + outline.names.get(edge["source"], "?")
+        if "target" in edge:
+            line += " -> " + outline.names.get(edge["target"], "?")
+        if "selector" in edge:
+            line += " selector=" + json.dumps(edge["selector"])
+        print(line)
+
+
+def collect_keys(value, keys):
+    """Owning modules and keys of the declarations of an export made with DECL_KEYS=1."""
+    if is_decl(value) and "key" in value[1][0]:
+        keys.add((value[1][0].get("owning_module"), value[1][0]["key"]))
+    if isinstance(value, list):
+        for child in value:
+            collect_keys(child, keys)
+    elif isinstance(value, dict):
+        for child in value.values():
+            collect_keys(child, keys)
+
+
+def load(fname):
+    f = sys.stdin if fname == "-" else open(fname, "r")
+    return json.load(f, object_pairs_hook=collections.OrderedDict)
+
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Print an outline of a Json AST.')
+    arg_parser.add_argument(metavar="FILE", dest="input_file", help="Json AST ('-' for stdin)")
+    arg_parser.add_argument("--field", metavar="KEY", dest="fields", action="append", default=[],
+                            help="print the values of this field")
+    arg_parser.add_argument("--class", metavar="KEY", dest="classes", action="append", default=[],
+                            help="print the values of this field as #N, where N numbers the distinct values")
+    arg_parser.add_argument("--imports", metavar="FILE", dest="module_files", action="append", default=[],
+                            help="resolve imported declarations against this export made with DECL_KEYS=1")
+    arg_parser.add_argument("--profile", metavar="FILE", dest="profile_file",
+                            help="print the method lookup counters of this profile made with PROFILE_FILE")
+    arg_parser.add_argument("--references", metavar="FILE", dest="reference_graph_file",
+                            help="print the edges of this reference graph made with REFERENCE_GRAPH_FILE")
+    args = arg_parser.parse_args()
+    module_keys = None
+    if args.module_files:
+        module_keys = set()
+        for module_file in args.module_files:
+            collect_keys(load(module_file), module_keys)
+    ast = load(args.input_file)
+    outline = Outline(set(args.fields), set(args.classes), module_keys)
+    outline.collect_names(ast)
+    outline.print_decls(ast, 0)
+    if args.profile_file:
+        # the number of dumped nodes is left out, as it depends on the version of clang
+        profile = load(args.profile_file)
+        for key in ["method_lookups", "method_lookup_cache_hits"]:
+            print("%s=%d" % (key, profile[key]))
+    if args.reference_graph_file:
+        print_references(outline, load(args.reference_graph_file))
+
+
+if __name__ == '__main__':
+    main()
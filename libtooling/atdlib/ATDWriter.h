@@ -11,22 +11,53 @@
 #pragma once
 
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace ATDWriter {
 
+  // Numbering of the field names of a schema, e.g. the FieldNames table
+  // generated by generate_record_fields.py.
+  class FieldIds {
+    std::unordered_map<std::string, int> ids_;
+  public:
+    template <size_t N>
+    FieldIds(const char *const (&names)[N]) {
+      for (size_t i = 0; i < N; i++) {
+        ids_[names[i]] = i;
+      }
+    }
+    // -1 if the name is not in the schema
+    int find(const std::string &name) const {
+      auto it = ids_.find(name);
+      return it == ids_.end() ? -1 : it->second;
+    }
+  };
+
   struct ATDWriterOptions {
     bool useYojson;
     bool prettifyJson;
+    // Compact JSON dialect: when set, the tags of the fields found in the
+    // schema are written as their IDs, e.g. "3" : ... instead of "name" : ...
+    // Other tags are written in full. Names never start with a digit, so
+    // readers can tell them apart.
+    const FieldIds *fieldIds;
   };
 
   // Symbols to be stacked
   enum Symbol {
     SARRAY,
+    STABLE,
     STUPLE,
     SOBJECT,
     SVARIANT,
+    SSHARED,
     STAG
   };
 
@@ -37,209 +68,401 @@ namespace ATDWriter {
     CSKMAX    // the container expects at most this number of items
   };
 
-  // Main class for writing ATD-like data
-  // - In NDEBUG mode this class is only a wrapper around an ATDEmitter
-  // - In DEBUG mode it acts as a validator: asserts will fire if the events do not correspond to a well-formed ATD/JSON value
-  template <class ATDEmitter>
-  class GenWriter {
+  // Set of the fields present in an object of an ATD record type.
+  // Record is a descriptor generated by generate_record_fields.py: it numbers
+  // the fields of the record and gives the mask of the fields that are always
+  // present. Only the optional fields need to be set.
+  template <class Record>
+  class RecordFields {
+    uint64_t present_;
+  public:
+    RecordFields() : present_(Record::RequiredFields) {}
+    RecordFields &set(typename Record::Field field, bool isPresent = true) {
+      present_ |= (uint64_t) isPresent << field;
+      return *this;
+    }
+    bool has(typename Record::Field field) const {
+      return (present_ >> field) & 1;
+    }
+    int count() const {
+      return __builtin_popcountll(present_);
+    }
+  };
 
-  protected:
-    ATDEmitter emitter_;
+  // Validation policies of GenWriter. A validator is told about every event
+  // before it reaches the emitter, and checks that the events form a
+  // well-formed ATD/JSON value.
 
-  private:
-#ifdef DEBUG
-    // State of the automaton
-    std::vector<enum Symbol> stack_;
+  // Checks nothing.
+  class NoValidator {
+  public:
+    void setEnabled(bool) {}
+    void setMaxValues(uint64_t) {}
+    void emitValue() {}
+    void emitTag() {}
+    void emitFlag(bool) {}
+    void enterContainer(enum Symbol, enum ContainerSizeKind = CSKNONE, int = 0) {}
+    void leaveContainer(enum Symbol) {}
+    void finish() {}
+    bool isInTable() const { return false; }
+    const char *error() const { return nullptr; }
+  };
+
+  // Checks the events with a stack automaton.
+  // - Each entry of the stack packs a Symbol and, for containers, their
+  //   ContainerSizeKind into a few bits, so that the stack of a deep value
+  //   fits in a couple of words.
+  // - Validation can be turned off, or limited to the first values of the
+  //   output, to bound its cost when it runs in production. It stops for
+  //   good at the first error.
+  // - The first error is recorded in error(). Unless NDEBUG is defined, it
+  //   also aborts like an assert.
+  class StackValidator {
+    static const unsigned entryBits = 5;
+    static const unsigned entriesPerWord = 64 / entryBits;
+    static const uint64_t entryMask = (1 << entryBits) - 1;
+    // Not a Symbol, stands for the entries below the bottom of the stack
+    static const unsigned noEntry = 7;
+
+    // State of the automaton. The two entries at the top of the stack are
+    // kept unpacked in top_ and below_.
+    std::vector<uint64_t> stack_;
+    size_t depth_;
+    unsigned top_;
+    unsigned below_;
+
+    // How many elements are still expected in the containers with a size
+    std::vector<int> containerSize_;
+
+    bool enabled_;
+    uint64_t maxValues_;
+    uint64_t numValues_;
+    const char *error_;
+
+    static enum Symbol symbolOf(unsigned e) {
+      return (enum Symbol) (e & 7);
+    }
+    static enum ContainerSizeKind sizeKindOf(unsigned e) {
+      return (enum ContainerSizeKind) (e >> 3);
+    }
+    unsigned load(size_t i) const {
+      return (stack_[i / entriesPerWord] >> (i % entriesPerWord * entryBits)) & entryMask;
+    }
+    void store(size_t i, unsigned e) {
+      size_t word = i / entriesPerWord;
+      unsigned shift = i % entriesPerWord * entryBits;
+      if (word == stack_.size()) {
+        stack_.push_back(0);
+      }
+      stack_[word] = (stack_[word] & ~(entryMask << shift)) | ((uint64_t) e << shift);
+    }
+    void push(enum Symbol s, enum ContainerSizeKind csk = CSKNONE) {
+      if (depth_ >= 2) {
+        store(depth_ - 2, below_);
+      }
+      below_ = top_;
+      top_ = s | csk << 3;
+      depth_++;
+    }
+    void pop() {
+      depth_--;
+      top_ = below_;
+      below_ = depth_ >= 2 ? load(depth_ - 2) : noEntry;
+    }
 
     // Objects want tagged values
-    static bool needsTag(enum Symbol s) {
-      return s == SOBJECT;
+    static bool needsTag(unsigned e) {
+      return symbolOf(e) == SOBJECT;
     }
 
-    // How many elements are expected in the current container
-    std::vector<int> containerSize_;
-    std::vector<enum ContainerSizeKind> containerSizeKind_;
+    void check(bool cond, const char *what) {
+      if (cond) {
+        return;
+      }
+      error_ = what;
+      enabled_ = false;
+#ifndef NDEBUG
+      std::cerr << "ATDWriter: " << what << std::endl;
+      abort();
 #endif
+    }
 
     void enterValue() {
-#ifdef DEBUG
-      if (stack_.empty()) {
+      if (maxValues_ != 0 && ++numValues_ > maxValues_) {
+        enabled_ = false;
         return;
       }
-      assert(!needsTag(stack_.back()));
-#endif
+      check(!needsTag(top_), "untagged value in an object");
     }
 
     void leaveValue() {
-#ifdef DEBUG
-      switch (containerSizeKind_.back()) {
-      case CSKEXACT:
-      case CSKMAX:
+      bool isTagged = symbolOf(top_) == STAG;
+      // The innermost container is below the tag, if any
+      if (sizeKindOf(isTagged ? below_ : top_) != CSKNONE) {
         containerSize_.back() -= 1;
-        break;
-      case CSKNONE:
-        break;
       }
-      if (stack_.empty()) {
-        return;
-      }
-      if (stack_.back() == STAG) {
-        stack_.pop_back();
-        assert(needsTag(stack_.back()));
+      if (isTagged) {
+        pop();
       }
-#endif
+    }
+
+  public:
+    StackValidator()
+      : depth_(0), top_(noEntry), below_(noEntry),
+        enabled_(true), maxValues_(0), numValues_(0), error_(nullptr) {}
+
+    // Must be called before the first event.
+    void setEnabled(bool enabled) {
+      enabled_ = enabled;
+    }
+    // Only validate the first values of the output (0 for no limit).
+    void setMaxValues(uint64_t maxValues) {
+      maxValues_ = maxValues;
+    }
+    const char *error() const {
+      return error_;
     }
 
     void emitValue() {
+      if (!enabled_) {
+        return;
+      }
+      check(!isInTable(), "tables only hold objects");
       enterValue();
-      leaveValue();
+      if (enabled_) {
+        leaveValue();
+      }
+    }
+
+    void emitTag() {
+      if (!enabled_) {
+        return;
+      }
+      check(needsTag(top_), "tag outside of an object");
+      push(STAG);
+    }
+
+    // Flags are omitted when false, except in the rows of tables.
+    void emitFlag(bool val) {
+      if (val || isInTableRow()) {
+        emitTag();
+        emitValue();
+      }
     }
 
     void enterContainer(enum Symbol s, enum ContainerSizeKind csk = CSKNONE, int numElems = 0) {
-#ifdef DEBUG
+      if (!enabled_) {
+        return;
+      }
+      check(!isInTable() || (s == SOBJECT && csk == CSKEXACT), "table rows must be objects with an exact size");
       enterValue();
-      stack_.push_back(s);
-      containerSizeKind_.push_back(csk);
-      switch (csk) {
-      case CSKEXACT:
-      case CSKMAX:
+      if (!enabled_) {
+        return;
+      }
+      push(s, csk);
+      if (csk != CSKNONE) {
         containerSize_.push_back(numElems);
-        break;
-      case CSKNONE:
-        break;
       }
-#endif
     }
 
     void leaveContainer(enum Symbol s) {
-#ifdef DEBUG
-      assert(stack_.back() == s);
-      stack_.pop_back();
-      switch (containerSizeKind_.back()) {
-      case CSKEXACT:
-        assert(containerSize_.back() == 0);
-      case CSKMAX:
-        assert(!containerSize_.empty());
-        assert(containerSize_.back() >= 0);
+      if (!enabled_) {
+        return;
+      }
+      check(symbolOf(top_) == s, "mismatched end of container");
+      if (!enabled_) {
+        return;
+      }
+      enum ContainerSizeKind csk = sizeKindOf(top_);
+      pop();
+      if (csk != CSKNONE) {
+        check(csk != CSKEXACT || containerSize_.back() == 0, "wrong number of items in a container");
+        check(containerSize_.back() >= 0, "too many items in a container");
         containerSize_.pop_back();
-        break;
-      case CSKNONE:
-        break;
       }
-      containerSizeKind_.pop_back();
       leaveValue();
-#endif
     }
 
-  public:
-    GenWriter(const ATDEmitter &emitter) : emitter_(emitter)
-    {
-#ifdef DEBUG
-      containerSizeKind_.push_back(CSKNONE);
-#endif
+    void finish() {
+      if (enabled_) {
+        check(depth_ == 0 && containerSize_.empty(), "unfinished value");
+      }
     }
 
-    ~GenWriter() {
+    bool isInTable() const {
+      return enabled_ && symbolOf(top_) == STABLE;
+    }
+
+    bool isInTableRow() const {
+      return enabled_ && symbolOf(top_) == SOBJECT && symbolOf(below_) == STABLE;
+    }
+  };
+
 #ifdef DEBUG
-      assert(stack_.empty());
-      assert(containerSizeKind_.size() == 1);
-      assert(containerSizeKind_.back() == CSKNONE);
+  typedef StackValidator DefaultValidator;
+#else
+  typedef NoValidator DefaultValidator;
 #endif
+
+  // Main class for writing ATD-like data
+  // - The emitter writes the events in a given format
+  // - The validator checks that the events correspond to a well-formed
+  //   ATD/JSON value. By default, events are only validated in DEBUG mode.
+  template <class ATDEmitter, class Validator = DefaultValidator>
+  class GenWriter {
+
+  protected:
+    ATDEmitter emitter_;
+
+  private:
+    Validator validator_;
+
+  public:
+    GenWriter(const ATDEmitter &emitter) : emitter_(emitter) {}
+
+    ~GenWriter() {
+      validator_.finish();
       emitter_.emitEOF();
     }
 
+    Validator &validator() {
+      return validator_;
+    }
+    const Validator &validator() const {
+      return validator_;
+    }
+
     void emitNull() {
-      emitValue();
+      validator_.emitValue();
       emitter_.emitNull();
     }
     void emitBoolean(bool val) {
-      emitValue();
+      validator_.emitValue();
       emitter_.emitBoolean(val);
     }
     void emitInteger(int val) {
-      emitValue();
+      validator_.emitValue();
       emitter_.emitInteger(val);
     }
-    void emitFloat(float val) {
-      emitValue();
+    void emitLongInteger(int64_t val) {
+      validator_.emitValue();
+      emitter_.emitLongInteger(val);
+    }
+    // same as emitLongInteger in JSON, but with a variable-length
+    // encoding in biniou
+    void emitVarInteger(int64_t val) {
+      validator_.emitValue();
+      emitter_.emitVarInteger(val);
+    }
+    void emitFloat(double val) {
+      validator_.emitValue();
       emitter_.emitFloat(val);
     }
     void emitString(const std::string &val) {
-      emitValue();
-      emitter_.emitString(val);
+      validator_.emitValue();
+      emitter_.emitString(val.data(), val.size());
+    }
+    // for strings that are not held by a std::string
+    void emitString(const char *val, size_t size) {
+      validator_.emitValue();
+      emitter_.emitString(val, size);
     }
     void emitTag(const std::string &val) {
-#ifdef DEBUG
-      assert(needsTag(stack_.back()));
-      stack_.push_back(STAG);
-#endif
+      validator_.emitTag();
       emitter_.emitTag(val);
     }
 
     void enterArray(int numElems) {
-      enterContainer(SARRAY, CSKEXACT, numElems);
+      validator_.enterContainer(SARRAY, CSKEXACT, numElems);
       emitter_.enterArray(numElems);
     }
     void enterArray() {
-      enterContainer(SARRAY);
+      validator_.enterContainer(SARRAY);
       emitter_.enterArray();
     }
     void leaveArray() {
-      leaveContainer(SARRAY);
+      validator_.leaveContainer(SARRAY);
       emitter_.leaveArray();
     }
+    // Array of objects with the same fields, in the same order. Fields with
+    // default values must be emitted explicitly.
+    void enterTable(int numElems) {
+      validator_.enterContainer(STABLE, CSKEXACT, numElems);
+      emitter_.enterTable(numElems);
+    }
+    void enterTable() {
+      validator_.enterContainer(STABLE);
+      emitter_.enterTable();
+    }
+    void leaveTable() {
+      validator_.leaveContainer(STABLE);
+      emitter_.leaveTable();
+    }
     void enterObject(int numElems) {
-      enterContainer(SOBJECT, CSKMAX, numElems);
+      validator_.enterContainer(SOBJECT, CSKEXACT, numElems);
       emitter_.enterObject(numElems);
     }
     void enterObject() {
-      enterContainer(SOBJECT);
+      validator_.enterContainer(SOBJECT);
       emitter_.enterObject();
     }
     void leaveObject() {
-      leaveContainer(SOBJECT);
+      validator_.leaveContainer(SOBJECT);
       emitter_.leaveObject();
     }
     void enterTuple(int numElems) {
-      enterContainer(STUPLE, CSKEXACT, numElems);
+      validator_.enterContainer(STUPLE, CSKEXACT, numElems);
       emitter_.enterTuple(numElems);
     }
     void enterTuple() {
-      enterContainer(STUPLE);
+      validator_.enterContainer(STUPLE);
       emitter_.enterTuple();
     }
     void leaveTuple() {
-      leaveContainer(STUPLE);
+      validator_.leaveContainer(STUPLE);
       emitter_.leaveTuple();
     }
 
     void enterVariant(const std::string &tag, bool hasArg = true) {
       // variants have at most one value, so we can safely use hasArg
       // as the number of arguments
-      enterContainer(SVARIANT, CSKEXACT, hasArg);
+      validator_.enterContainer(SVARIANT, CSKEXACT, hasArg);
       emitter_.enterVariant();
       emitter_.emitVariantTag(tag, hasArg);
     }
     void leaveVariant() {
-      leaveContainer(SVARIANT);
+      validator_.leaveContainer(SVARIANT);
       emitter_.leaveVariant();
     }
+    // Structural sharing: a value emitted between enterShared and leaveShared
+    // may be referred to later on by its id with emitSharedRef.
+    void enterShared(unsigned id) {
+      validator_.enterContainer(SSHARED, CSKEXACT, 1);
+      emitter_.enterShared(id);
+    }
+    void leaveShared() {
+      validator_.leaveContainer(SSHARED);
+      emitter_.leaveShared();
+    }
+    void emitSharedRef(unsigned id) {
+      validator_.emitValue();
+      emitter_.emitSharedRef(id);
+    }
+
+    // Each emitter decides how to represent variants without arguments.
     void emitSimpleVariant(const std::string &tag) {
-      if (emitter_.shouldSimpleVariantsBeEmittedAsStrings) {
-        emitString(tag);
-      } else {
-        enterVariant(tag, false);
-        leaveVariant();
-      }
+      validator_.emitValue();
+      emitter_.emitSimpleVariant(tag);
     }
 
     // convenient methods
 
+    // Flags are omitted when false, except by the emitters that write the
+    // rows of tables with all their fields. Flags always count in the size
+    // of a row.
     void emitFlag(const std::string &tag, bool val) {
-      if (val) {
-        emitTag(tag);
-        emitBoolean(true);
-      }
+      validator_.emitFlag(val);
+      emitter_.emitFlag(tag, val);
     }
 
     // convenient classes for automatically closing containers using C++ scoping
@@ -258,12 +481,30 @@ namespace ATDWriter {
       }
     };
 
+    class TableScope {
+      GenWriter &f_;
+    public:
+      TableScope(GenWriter &f, int size) : f_(f) {
+        f_.enterTable(size);
+      }
+      TableScope(GenWriter &f) : f_(f) {
+        f_.enterTable();
+      }
+      ~TableScope() {
+        f_.leaveTable();
+      }
+    };
+
     class ObjectScope {
       GenWriter &f_;
     public:
       ObjectScope(GenWriter &f, int size) : f_(f) {
         f_.enterObject(size);
       }
+      template <class Record>
+      ObjectScope(GenWriter &f, const RecordFields<Record> &fields) : f_(f) {
+        f_.enterObject(fields.count());
+      }
       ObjectScope(GenWriter &f) : f_(f) {
         f_.enterObject();
       }
@@ -364,7 +605,11 @@ namespace ATDWriter {
   private:
     // TODO: unicode and other control chars
     void write_escaped(const std::string &val) {
-      for (std::string::const_iterator i = val.begin(), e = val.end(); i != e; i++) {
+      write_escaped(val.data(), val.size());
+    }
+
+    void write_escaped(const char *val, size_t size) {
+      for (const char *i = val, *e = val + size; i != e; i++) {
         char x = *i;
         switch (x) {
           case '\\': os_ << "\\\\"; break;
@@ -424,10 +669,39 @@ namespace ATDWriter {
       nextElementNeedsNewLine_ = true;
       previousElementIsVariantTag_ = false;
     }
-    void emitString(const std::string &val) {
+    void emitLongInteger(int64_t val) {
+      tab();
+      os_ << val;
+      previousElementNeedsComma_ = true;
+      nextElementNeedsNewLine_ = true;
+      previousElementIsVariantTag_ = false;
+    }
+    void emitVarInteger(int64_t val) {
+      emitLongInteger(val);
+    }
+    // Shortest decimal representation that reads back as the same double,
+    // always with a dot or an exponent so that it is not parsed as an int.
+    void emitFloat(double val) {
+      tab();
+      char buf[32];
+      for (int precision = 1; precision <= 17; precision++) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, val);
+        if (strtod(buf, nullptr) == val) {
+          break;
+        }
+      }
+      os_ << buf;
+      if (strpbrk(buf, ".en") == nullptr) {
+        os_ << ".0";
+      }
+      previousElementNeedsComma_ = true;
+      nextElementNeedsNewLine_ = true;
+      previousElementIsVariantTag_ = false;
+    }
+    void emitString(const char *val, size_t size) {
       tab();
       os_ << QUOTE;
-      write_escaped(val);
+      write_escaped(val, size);
       os_ << QUOTE;
       previousElementNeedsComma_ = true;
       nextElementNeedsNewLine_ = true;
@@ -435,8 +709,13 @@ namespace ATDWriter {
     }
     void emitTag(const std::string &val) {
       tab();
+      int id = options_.fieldIds ? options_.fieldIds->find(val) : -1;
       os_ << QUOTE;
-      write_escaped(val);
+      if (id >= 0) {
+        os_ << id;
+      } else {
+        write_escaped(val);
+      }
       os_ << QUOTE;
       if (options_.prettifyJson) {
         os_ << COLONWITHSPACES;
@@ -447,6 +726,13 @@ namespace ATDWriter {
       nextElementNeedsNewLine_ = false;
       previousElementIsVariantTag_ = false;
     }
+
+    void emitFlag(const std::string &tag, bool val) {
+      if (val) {
+        emitTag(tag);
+        emitBoolean(true);
+      }
+    }
     void emitVariantTag(const std::string &val, bool hasArgs) {
       tab();
       os_ << QUOTE;
@@ -466,6 +752,15 @@ namespace ATDWriter {
     void leaveArray() {
       leaveContainer(RBRACKET);
     }
+    void enterTable() {
+      enterArray();
+    }
+    void enterTable(int size) {
+      enterArray();
+    }
+    void leaveTable() {
+      leaveArray();
+    }
     void enterObject() {
       enterContainer(LBRACE);
     }
@@ -484,6 +779,23 @@ namespace ATDWriter {
     void leaveTuple() {
       leaveContainer(options_.useYojson ? RPAREN : RBRACKET);
     }
+    // Shared values are wrapped as {"@shared" : id, "@value" : value}
+    // and references are written {"@ref" : id}.
+    void enterShared(unsigned id) {
+      enterObject();
+      emitTag("@shared");
+      emitInteger(id);
+      emitTag("@value");
+    }
+    void leaveShared() {
+      leaveObject();
+    }
+    void emitSharedRef(unsigned id) {
+      enterObject();
+      emitTag("@ref");
+      emitInteger(id);
+      leaveObject();
+    }
     void enterVariant() {
       enterContainer(options_.useYojson ? LANGLE : LBRACKET);
       // cancel indent
@@ -495,6 +807,15 @@ namespace ATDWriter {
       leaveContainer(options_.useYojson ? RANGLE : RBRACKET);
       indentLevel_++;
     }
+    void emitSimpleVariant(const std::string &tag) {
+      if (shouldSimpleVariantsBeEmittedAsStrings) {
+        emitString(tag.data(), tag.size());
+      } else {
+        enterVariant();
+        emitVariantTag(tag, false);
+        leaveVariant();
+      }
+    }
 
   };
 
@@ -521,32 +842,38 @@ namespace ATDWriter {
     const uint8_t VARIANT_tag = 23;
     const uint8_t unit_tag = 24;
     const uint8_t TABLE_tag = 25;
-    const uint8_t SHARED_tag = 26;
-
-    // How many elements do we expect at most for the currently opened RECORDs?
-    // Records must remember how many items are supposed to be in the record.
-    // If a record is closed when not all items have been emitted then the
-    // remaining number of dummy items are emitted to make biniou happy.
-    // This is because, thanks to optional fields and fields with default arguments,
-    // it can be hard to precisely estimate how many items of the record are
-    // actually going to be emitted in advance.
-    std::vector<int> recordMaxSize_;
+
     // Are we the first element of an array?
     // This is needed because arrays are monomorphic and only the first element
     // of the array carries a value tag.
     bool isFirstInArray_;
-    // Are we currently in a record/an array?
-    std::vector<bool> isCurrentValueInRecord_;
+    // Are we currently in an array/a table/a row of a table?
     std::vector<bool> isCurrentValueInArray_;
+    std::vector<bool> isCurrentValueInTable_;
+    std::vector<bool> isCurrentValueInTableRow_;
+    // Tables write the field tags and the value tags of their columns once,
+    // in a header that precedes the rows. Values are then written untagged.
+    // The header is collected while the first row is emitted, and the first
+    // row is buffered until then.
+    std::vector<bool> isCurrentValueInFirstTableRow_;
+    std::vector<std::string> tableHeaders_;
+    // Containers whose size is not known in advance are buffered until they
+    // are closed, counting the values they receive. Their size is then written
+    // before the buffered values.
+    std::vector<bool> isCurrentContainerUnsized_;
+    std::vector<int> numValuesInContainer_;
+    std::vector<std::string> buffers_;
 
   public:
-    bool shouldSimpleVariantsBeEmittedAsStrings = false;
-
     BiniouEmitter(OStream &os)
     : os_(os)
     {
-      isCurrentValueInRecord_.push_back(false);
       isCurrentValueInArray_.push_back(false);
+      isCurrentValueInTable_.push_back(false);
+      isCurrentValueInTableRow_.push_back(false);
+      isCurrentValueInFirstTableRow_.push_back(false);
+      isCurrentContainerUnsized_.push_back(false);
+      numValuesInContainer_.push_back(0);
     }
 
   private:
@@ -555,31 +882,57 @@ namespace ATDWriter {
       if (size >= 0) {
         writeUvint(size);
       }
+      pushContainer(tag, size, false);
+    }
+
+    void enterUnsizedContainer(uint8_t tag) {
+      writeValueTag(tag);
+      // the size is written in leaveContainer
+      buffers_.push_back(std::string());
+      pushContainer(tag, -1, true);
+    }
 
-      bool isRecord = tag == RECORD_tag;
-      isCurrentValueInRecord_.push_back(isRecord);
+    void pushContainer(uint8_t tag, int size, bool isUnsized,
+                       bool isTableRow = false, bool isFirstTableRow = false) {
+      isCurrentContainerUnsized_.push_back(isUnsized);
+      numValuesInContainer_.push_back(0);
       bool isArray = tag == ARRAY_tag;
       isCurrentValueInArray_.push_back(isArray);
+      bool isTable = tag == TABLE_tag;
+      isCurrentValueInTable_.push_back(isTable);
+      isCurrentValueInTableRow_.push_back(isTableRow);
+      isCurrentValueInFirstTableRow_.push_back(isFirstTableRow);
 
       // extra initialization for some containers
       if (isArray) {
         isFirstInArray_ = true;
       }
-      if (isRecord) {
-        recordMaxSize_.push_back(size);
+      if (isTable) {
+        tableHeaders_.push_back(std::string());
       }
     }
 
     void leaveValue() {
-      if (isCurrentValueInRecord_.back()) {
-        recordMaxSize_.back() -= 1;
-      }
+      numValuesInContainer_.back() += 1;
       isFirstInArray_ = false;
     }
 
     void leaveContainer() {
-      isCurrentValueInRecord_.pop_back();
+      bool isUnsized = isCurrentContainerUnsized_.back();
+      int numValues = numValuesInContainer_.back();
+      isCurrentContainerUnsized_.pop_back();
+      numValuesInContainer_.pop_back();
       isCurrentValueInArray_.pop_back();
+      isCurrentValueInTable_.pop_back();
+      isCurrentValueInTableRow_.pop_back();
+      isCurrentValueInFirstTableRow_.pop_back();
+      if (isUnsized) {
+        std::string buffer;
+        buffer.swap(buffers_.back());
+        buffers_.pop_back();
+        writeUvint(numValues);
+        writeRaw(buffer.data(), buffer.size());
+      }
       leaveValue();
     }
 
@@ -593,8 +946,16 @@ namespace ATDWriter {
       return hash;
     }
 
+    void writeRaw(const char *data, size_t size) {
+      if (buffers_.empty()) {
+        os_.write(data, size);
+      } else {
+        buffers_.back().append(data, size);
+      }
+    }
+
     void write8(uint8_t c) {
-      os_.write((const char *)&c, 1);
+      writeRaw((const char *)&c, 1);
     }
 
     void write32(int32_t x) {
@@ -609,26 +970,50 @@ namespace ATDWriter {
       write32(x);
     }
 
+    // 7 bits at a time, least significant first
     void writeUvint(size_t x) {
       while (x > 127) {
-        write8(x | 0x100);
-        x >>= 8;
+        write8((x & 0x7f) | 0x80);
+        x >>= 7;
       }
 
       write8((uint8_t) x);
     }
 
     void writeValueTag(uint8_t tag) {
-      if (!isCurrentValueInArray_.back() || isFirstInArray_) {
+      if (isCurrentValueInTableRow_.back()) {
+        std::string &header = tableHeaders_.back();
+        if (isCurrentValueInFirstTableRow_.back()) {
+          header.push_back(tag);
+        }
+        assert((uint8_t) header[5 * numValuesInContainer_.back() + 4] == tag);
+      } else if (!isCurrentValueInArray_.back() || isFirstInArray_) {
         write8(tag);
       }
     }
 
-    void emitDummyRecordField() {
-      emitTag("!!DUMMY!!");
-      // unit is the smallest value (2 bytes)
-      write8(unit_tag);
-      write8(0);
+    // The number of columns is the size of the first row.
+    void enterTableRow(int size) {
+      bool isFirstRow = numValuesInContainer_.back() == 0;
+      if (isFirstRow) {
+        writeUvint(size);
+        // the header is written before the row, see leaveTableRow
+        buffers_.push_back(std::string());
+      }
+      pushContainer(RECORD_tag, size, false, true, isFirstRow);
+    }
+
+    void leaveTableRow() {
+      bool isFirstRow = isCurrentValueInFirstTableRow_.back();
+      leaveContainer();
+      if (isFirstRow) {
+        std::string row;
+        row.swap(buffers_.back());
+        buffers_.pop_back();
+        const std::string &header = tableHeaders_.back();
+        writeRaw(header.data(), header.size());
+        writeRaw(row.data(), row.size());
+      }
     }
 
   public:
@@ -647,11 +1032,38 @@ namespace ATDWriter {
       leaveValue();
     }
 
-    void emitString(const std::string &val) {
+    // for values that may not fit in 32 bits (e.g. file offsets)
+    void emitLongInteger(int64_t val) {
+      writeValueTag(int64_tag);
+      write64(val);
+      leaveValue();
+    }
+
+    // the sign is the 7th bit of the last byte, see writeUvint
+    void emitVarInteger(int64_t val) {
+      writeValueTag(svint_tag);
+      uint64_t x = val < 0 ? -(uint64_t) val : val;
+      while (x > 63) {
+        write8((x & 0x7f) | 0x80);
+        x >>= 7;
+      }
+      write8((uint8_t) x | (val < 0 ? 0x40 : 0));
+      leaveValue();
+    }
+
+    void emitFloat(double val) {
+      writeValueTag(float64_tag);
+      int64_t bits;
+      memcpy(&bits, &val, sizeof(bits));
+      write64(bits);
+      leaveValue();
+    }
+
+    void emitString(const char *val, size_t size) {
       writeValueTag(string_tag);
-      writeUvint(val.length());
-      for(const char &c: val) {
-        write8(c);
+      writeUvint(size);
+      for (size_t i = 0; i < size; i++) {
+        write8(val[i]);
       }
       leaveValue();
     }
@@ -660,9 +1072,29 @@ namespace ATDWriter {
       int32_t hash = biniou_hash(val);
       // set first bit of hash
       hash |= 1 << 31;
+      if (isCurrentValueInTableRow_.back()) {
+        std::string &header = tableHeaders_.back();
+        if (isCurrentValueInFirstTableRow_.back()) {
+          for (int shift = 24; shift >= 0; shift -= 8) {
+            header.push_back((char) (hash >> shift));
+          }
+        }
+        // every row has the fields of the first row, in the same order
+        assert(header.compare(5 * numValuesInContainer_.back(), 4,
+                              std::string({(char) (hash >> 24), (char) (hash >> 16),
+                                           (char) (hash >> 8), (char) hash})) == 0);
+        return;
+      }
       write32(hash);
     }
 
+    void emitFlag(const std::string &tag, bool val) {
+      if (val || isCurrentValueInTableRow_.back()) {
+        emitTag(tag);
+        emitBoolean(val);
+      }
+    }
+
     void emitVariantTag(const std::string &val, bool hasArg) {
       int32_t hash = biniou_hash(val);
       // set first bit of hash if the variant has an argument
@@ -675,22 +1107,47 @@ namespace ATDWriter {
     void enterArray(int size) {
       enterContainer(ARRAY_tag, size);
     }
+    void enterArray() {
+      enterUnsizedContainer(ARRAY_tag);
+    }
     void leaveArray() {
       leaveContainer();
     }
+    void enterTable(int size) {
+      enterContainer(TABLE_tag, size);
+    }
+    void enterTable() {
+      enterUnsizedContainer(TABLE_tag);
+    }
+    void leaveTable() {
+      tableHeaders_.pop_back();
+      leaveContainer();
+    }
     void enterObject(int size) {
-      enterContainer(RECORD_tag, size);
+      if (isCurrentValueInTable_.back()) {
+        enterTableRow(size);
+      } else {
+        enterContainer(RECORD_tag, size);
+      }
+    }
+    void enterObject() {
+      // the rows of a table must be sized
+      assert(!isCurrentValueInTable_.back());
+      enterUnsizedContainer(RECORD_tag);
     }
     void leaveObject() {
-      for (int i = recordMaxSize_.back(); i > 0; --i) {
-        emitDummyRecordField();
+      if (isCurrentValueInTableRow_.back()) {
+        leaveTableRow();
+        return;
       }
-      recordMaxSize_.back() = 0; // just in case
       leaveContainer();
     }
     void enterTuple(int size) {
       enterContainer(TUPLE_tag, size);
     }
+    void enterTuple() {
+      enterUnsizedContainer(TUPLE_tag);
+    }
     void leaveTuple() {
       leaveContainer();
     }
@@ -700,27 +1157,125 @@ namespace ATDWriter {
     void leaveVariant() {
       leaveContainer();
     }
+    void emitSimpleVariant(const std::string &tag) {
+      enterVariant();
+      emitVariantTag(tag, false);
+      leaveVariant();
+    }
 
   };
 
-  // The full class for JSON and YOJSON writing
+  // Fans every event out to a main JSON/Yojson emitter and to any number
+  // of extra JSON/Yojson and biniou emitters, each with its own stream.
+  // Extra emitters must be added before the first event.
   template <class OStream>
-  class JsonWriter : public GenWriter<JsonEmitter<OStream>> {
+  class TeeEmitter {
+
+  private:
+    JsonEmitter<OStream> main_;
+    std::vector<JsonEmitter<OStream>> jsonEmitters_;
+    std::vector<BiniouEmitter<OStream>> biniouEmitters_;
+
+#define ATD_TEE_JSON(CALL)                              \
+    main_.CALL;                                         \
+    for (JsonEmitter<OStream> &e : jsonEmitters_) {     \
+      e.CALL;                                           \
+    }
+#define ATD_TEE(CALL)                                   \
+    ATD_TEE_JSON(CALL)                                  \
+    for (BiniouEmitter<OStream> &e : biniouEmitters_) { \
+      e.CALL;                                           \
+    }
+
+  public:
+    TeeEmitter(OStream &os, const ATDWriterOptions opts) : main_(os, opts) {}
+
+    void addJsonEmitter(OStream &os, const ATDWriterOptions opts) {
+      jsonEmitters_.push_back(JsonEmitter<OStream>(os, opts));
+    }
+    void addBiniouEmitter(OStream &os) {
+      biniouEmitters_.push_back(BiniouEmitter<OStream>(os));
+    }
+
+    void emitEOF() { ATD_TEE(emitEOF()); }
+    void emitBoolean(bool val) { ATD_TEE(emitBoolean(val)); }
+    void emitInteger(int val) { ATD_TEE(emitInteger(val)); }
+    void emitLongInteger(int64_t val) { ATD_TEE(emitLongInteger(val)); }
+    void emitVarInteger(int64_t val) { ATD_TEE(emitVarInteger(val)); }
+    void emitFloat(double val) { ATD_TEE(emitFloat(val)); }
+    void emitString(const char *val, size_t size) { ATD_TEE(emitString(val, size)); }
+    void emitTag(const std::string &val) { ATD_TEE(emitTag(val)); }
+    void emitFlag(const std::string &tag, bool val) { ATD_TEE(emitFlag(tag, val)); }
+    void emitVariantTag(const std::string &val, bool hasArg) { ATD_TEE(emitVariantTag(val, hasArg)); }
+    void emitSimpleVariant(const std::string &tag) { ATD_TEE(emitSimpleVariant(tag)); }
+    void enterArray() { ATD_TEE(enterArray()); }
+    void enterArray(int size) { ATD_TEE(enterArray(size)); }
+    void leaveArray() { ATD_TEE(leaveArray()); }
+    void enterTable() { ATD_TEE(enterTable()); }
+    void enterTable(int size) { ATD_TEE(enterTable(size)); }
+    void leaveTable() { ATD_TEE(leaveTable()); }
+    void enterObject() { ATD_TEE(enterObject()); }
+    void enterObject(int size) { ATD_TEE(enterObject(size)); }
+    void leaveObject() { ATD_TEE(leaveObject()); }
+    void enterTuple() { ATD_TEE(enterTuple()); }
+    void enterTuple(int size) { ATD_TEE(enterTuple(size)); }
+    void leaveTuple() { ATD_TEE(leaveTuple()); }
+    void enterVariant() { ATD_TEE(enterVariant()); }
+    void leaveVariant() { ATD_TEE(leaveVariant()); }
+    // Shared values are only written in JSON/Yojson: the ATD specifications
+    // have no biniou counterpart for them.
+    void enterShared(unsigned id) {
+      assert(biniouEmitters_.empty());
+      ATD_TEE_JSON(enterShared(id));
+    }
+    void leaveShared() {
+      assert(biniouEmitters_.empty());
+      ATD_TEE_JSON(leaveShared());
+    }
+    void emitSharedRef(unsigned id) {
+      assert(biniouEmitters_.empty());
+      ATD_TEE_JSON(emitSharedRef(id));
+    }
+
+#undef ATD_TEE
+#undef ATD_TEE_JSON
+
+  };
+
+  // The full class for JSON and YOJSON writing
+  template <class OStream, class Validator = DefaultValidator>
+  class JsonWriter : public GenWriter<JsonEmitter<OStream>, Validator> {
     typedef JsonEmitter<OStream> Emitter;
   public:
     JsonWriter(OStream &os, const ATDWriterOptions opts)
-      : GenWriter<Emitter>(Emitter(os, opts))
+      : GenWriter<Emitter, Validator>(Emitter(os, opts))
       {}
   };
 
   // The full class for biniou writing
-  template <class OStream>
-  class BiniouWriter : public GenWriter<BiniouEmitter<OStream>> {
+  template <class OStream, class Validator = DefaultValidator>
+  class BiniouWriter : public GenWriter<BiniouEmitter<OStream>, Validator> {
     typedef BiniouEmitter<OStream> Emitter;
   public:
     BiniouWriter(OStream &os)
-      : GenWriter<Emitter>(Emitter(os))
+      : GenWriter<Emitter, Validator>(Emitter(os))
       {}
   };
 
+  // JSON or YOJSON writing, duplicated to extra JSON, YOJSON or biniou outputs
+  template <class OStream, class Validator = DefaultValidator>
+  class TeeWriter : public GenWriter<TeeEmitter<OStream>, Validator> {
+    typedef TeeEmitter<OStream> Emitter;
+  public:
+    TeeWriter(OStream &os, const ATDWriterOptions opts)
+      : GenWriter<Emitter, Validator>(Emitter(os, opts))
+      {}
+    void addJsonOutput(OStream &os, const ATDWriterOptions opts) {
+      this->emitter_.addJsonEmitter(os, opts);
+    }
+    void addBiniouOutput(OStream &os) {
+      this->emitter_.addBiniouEmitter(os);
+    }
+  };
+
 }
@@ -0,0 +1,123 @@
+# Copyright (c) 2015, Facebook, Inc.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree. An additional grant
+# of patent rights can be found in the PATENTS file in the same directory.
+
+import sys
+import re
+import argparse
+import hashlib
+
+"""
+Generate a C++ descriptor for each record type of an ATD file. A descriptor
+numbers the fields of the record in order and gives the mask of the fields
+that are always present, i.e. those that are neither optional (?field)
+nor with a default value (~field). See ATDWriter::RecordFields.
+
+Also generate the table of all the field names, numbered in order of first
+appearance, together with a version string that changes with the table.
+See ATDWriter::FieldIds.
+"""
+
+record_begin = re.compile(r'^ *type +([a-z_][a-z0-9_]*) *= *\{ *$')
+record_end = re.compile(r'^ *\}')
+field = re.compile(r'^ *([?~]?)([a-z_][a-zA-Z0-9_]*)')
+
+cpp_keywords = set([
+    "and", "asm", "auto", "bool", "break", "case", "catch", "char", "class",
+    "const", "continue", "default", "delete", "do", "double", "else", "enum",
+    "explicit", "export", "extern", "false", "float", "for", "friend", "goto",
+    "if", "inline", "int", "long", "mutable", "namespace", "new", "not",
+    "operator", "or", "private", "protected", "public", "register", "return",
+    "short", "signed", "sizeof", "static", "struct", "switch", "template",
+    "this", "throw", "true", "try", "typedef", "typename", "union",
+    "unsigned", "using", "virtual", "void", "volatile", "while", "xor",
+])
+
+def cpp_name(name, record_name = None):
+    """
+    Field names that are C++ keywords, or that are the name of their record,
+    are suffixed with an underscore.
+    """
+    return name + "_" if name in cpp_keywords or name == record_name else name
+
+def parse_records(file):
+    records = []
+    current = None
+    for line in file:
+        if line.startswith("#"):
+            continue
+        if current is None:
+            m = record_begin.match(line)
+            if m:
+                current = (m.group(1), [])
+            continue
+        if record_end.match(line):
+            records.append(current)
+            current = None
+            continue
+        m = field.match(line)
+        if m:
+            current[1].append((m.group(2), m.group(1) == ""))
+    return records
+
+def print_record(name, fields):
+    if len(fields) > 64:
+        sys.exit("Record %s has more than 64 fields" % name)
+    print("struct %s {" % cpp_name(name))
+    print("  enum Field {")
+    for (field_name, _) in fields:
+        print("    %s," % cpp_name(field_name, name))
+    print("    NumFields")
+    print("  };")
+    required = [cpp_name(f, name) for (f, is_required) in fields if is_required]
+    mask = " | ".join("(1ULL << %s)" % f for f in required) if required else "0"
+    print("  static const uint64_t RequiredFields = %s;" % mask)
+    print("};")
+    print("")
+
+def print_field_names(records):
+    names = []
+    seen = set()
+    for (_, fields) in records:
+        for (field_name, _) in fields:
+            if field_name not in seen:
+                seen.add(field_name)
+                names.append(field_name)
+    version = hashlib.sha1("\n".join(names).encode("utf-8")).hexdigest()[:16]
+    print("static const char *const FieldNames[] = {")
+    for field_name in names:
+        print("  \"%s\"," % field_name)
+    print("};")
+    print("static const char *const SchemaVersion = \"%s\";" % version)
+    print("")
+
+def start(file):
+    print("// Generated by generate_record_fields.py, do not edit.")
+    print("")
+    print("#pragma once")
+    print("")
+    print("#include <stdint.h>")
+    print("")
+    print("namespace ATDRecords {")
+    print("")
+    records = parse_records(file)
+    for (name, fields) in records:
+        print_record(name, fields)
+    print_field_names(records)
+    print("}")
+
+def main():
+    arg_parser = argparse.ArgumentParser(description='Generate C++ descriptors of the record types of an ATD file.')
+    arg_parser.add_argument(metavar="FILE", nargs='?', dest="input_file", help="Input ATD file (default: stdin)")
+    args = arg_parser.parse_args()
+    if args.input_file:
+        file = open(args.input_file, "r")
+    else:
+        file = sys.stdin
+    start(file)
+
+if __name__ == '__main__':
+    main()
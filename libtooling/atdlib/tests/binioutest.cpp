@@ -5,6 +5,7 @@ typedef BiniouWriter::ObjectScope ObjectScope;
 typedef BiniouWriter::ArrayScope ArrayScope;
 typedef BiniouWriter::VariantScope VariantScope;
 typedef BiniouWriter::TupleScope TupleScope;
+typedef BiniouWriter::TableScope TableScope;
 
 int main(int argc, char **argv) {
   {
@@ -57,7 +58,7 @@ int main(int argc, char **argv) {
   }
   {
     BiniouWriter OF(std::cout);
-    ObjectScope Scope(OF, 12); // 12 is larger than the actual size on purpose
+    ObjectScope Scope(OF, 3);
     OF.emitTag("string");
     OF.emitString("Hello");
     OF.emitTag("boolean");
@@ -91,7 +92,7 @@ int main(int argc, char **argv) {
         OF.emitInteger(32);
       }
       {
-        ObjectScope Scope(OF, 2);
+        ObjectScope Scope(OF, 1);
         OF.emitTag("integer");
         OF.emitInteger(52);
       }
@@ -128,6 +129,34 @@ int main(int argc, char **argv) {
       }
     }
   }
+  {
+    BiniouWriter OF(std::cout);
+    ArrayScope Scope(OF);
+    {
+      TupleScope Scope(OF);
+      OF.emitString("f");
+      OF.emitInteger(1);
+    }
+    {
+      TupleScope Scope(OF);
+    }
+  }
+  {
+    BiniouWriter OF(std::cout);
+    TableScope Scope(OF, 2);
+    {
+      ObjectScope Scope(OF, 2);
+      OF.emitTag("line");
+      OF.emitInteger(1);
+      OF.emitFlag("is_used", true);
+    }
+    {
+      ObjectScope Scope(OF, 2);
+      OF.emitTag("line");
+      OF.emitInteger(2);
+      OF.emitFlag("is_used", false);
+    }
+  }
 
   return 0;
 }
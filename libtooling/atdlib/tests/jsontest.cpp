@@ -1,3 +1,5 @@
+#include <sstream>
+
 #include "../ATDWriter.h"
 
 typedef ATDWriter::JsonWriter<std::ostream> JsonWriter;
@@ -5,21 +7,65 @@ typedef JsonWriter::ObjectScope ObjectScope;
 typedef JsonWriter::ArrayScope ArrayScope;
 typedef JsonWriter::VariantScope VariantScope;
 typedef JsonWriter::TupleScope TupleScope;
+typedef JsonWriter::TableScope TableScope;
+typedef ATDWriter::TeeWriter<std::ostream> TeeWriter;
+typedef ATDWriter::JsonWriter<std::ostream, ATDWriter::StackValidator> ValidatedJsonWriter;
+
+// Same as the output of generate_record_fields.py for
+// type point = { x : int; y : int; ?label : string option; ~visible : bool }
+struct point {
+  enum Field {
+    x,
+    y,
+    label,
+    visible,
+    NumFields
+  };
+  static const uint64_t RequiredFields = (1ULL << x) | (1ULL << y);
+};
+static const char *const FieldNames[] = {
+  "x",
+  "y",
+  "label",
+  "visible",
+};
 
 int main(int argc, char **argv) {
   const struct ATDWriter::ATDWriterOptions jsonWriterOptions = {
     .useYojson = false,
     .prettifyJson = true,
+    .fieldIds = nullptr,
   };
   const struct ATDWriter::ATDWriterOptions yojsonWriterOptions = {
     .useYojson = true,
     .prettifyJson = true,
+    .fieldIds = nullptr,
+  };
+  const ATDWriter::FieldIds fieldIds(FieldNames);
+  const struct ATDWriter::ATDWriterOptions compactWriterOptions = {
+    .useYojson = false,
+    .prettifyJson = false,
+    .fieldIds = &fieldIds,
   };
 
   {
     JsonWriter OF(std::cout, yojsonWriterOptions);
     OF.emitInteger(100000);
   }
+  {
+    JsonWriter OF(std::cout, yojsonWriterOptions);
+    OF.emitLongInteger(5000000000);
+  }
+  {
+    JsonWriter OF(std::cout, yojsonWriterOptions);
+    ArrayScope Scope(OF, 6);
+    OF.emitVarInteger(-4611686018427387904);
+    OF.emitFloat(0.1);
+    OF.emitFloat(3);
+    OF.emitFloat(-2.5e-8);
+    OF.emitFloat(1e300);
+    OF.emitFloat(1.0 / 3);
+  }
   {
     JsonWriter OF(std::cout, yojsonWriterOptions);
     OF.emitString("Hello");
@@ -37,7 +83,7 @@ int main(int argc, char **argv) {
   }
   {
     JsonWriter OF(std::cout, yojsonWriterOptions);
-    ObjectScope Scope(OF, 4); // 4 is larger than the actual size on purpose
+    ObjectScope Scope(OF, 3);
     OF.emitTag("string");
     OF.emitString("Hello");
     OF.emitTag("boolean");
@@ -88,6 +134,81 @@ int main(int argc, char **argv) {
       }
     }
   }
+  {
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    ArrayScope Scope(OF, 3);
+    OF.enterShared(0);
+    {
+      ObjectScope Scope(OF, 1);
+      OF.emitTag("raw");
+      OF.emitString("int");
+    }
+    OF.leaveShared();
+    OF.emitSharedRef(0);
+    OF.emitString("end");
+  }
+  {
+    std::ostringstream yojson;
+    {
+      TeeWriter OF(std::cout, jsonWriterOptions);
+      OF.addJsonOutput(yojson, yojsonWriterOptions);
+      TeeWriter::TupleScope Scope(OF, 2);
+      OF.emitSimpleVariant("zero");
+      OF.emitString("tee");
+    }
+    std::cout << yojson.str();
+  }
+  {
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    ATDWriter::RecordFields<point> Fields;
+    Fields.set(point::label).set(point::visible, false);
+    ObjectScope Scope(OF, Fields);
+    OF.emitTag("x");
+    OF.emitInteger(1);
+    OF.emitTag("y");
+    OF.emitInteger(2);
+    OF.emitTag("label");
+    OF.emitString("origin");
+    OF.emitFlag("visible", Fields.has(point::visible));
+  }
+  {
+    JsonWriter OF(std::cout, jsonWriterOptions);
+    TableScope Scope(OF, 2);
+    {
+      ObjectScope Scope(OF, 2);
+      OF.emitTag("name");
+      OF.emitString("A");
+      OF.emitFlag("virtual", false);
+    }
+    {
+      ObjectScope Scope(OF, 2);
+      OF.emitTag("name");
+      OF.emitString("B");
+      OF.emitFlag("virtual", true);
+    }
+  }
+  {
+    // Only the first two values are validated: the extra item goes unnoticed.
+    ValidatedJsonWriter OF(std::cout, jsonWriterOptions);
+    OF.validator().setMaxValues(2);
+    {
+      ValidatedJsonWriter::ArrayScope Scope(OF, 1);
+      OF.emitInteger(1);
+      OF.emitInteger(2);
+    }
+    assert(OF.validator().error() == nullptr);
+  }
+  {
+    // Tags outside of the schema are written in full.
+    JsonWriter OF(std::cout, compactWriterOptions);
+    ObjectScope Scope(OF, 3);
+    OF.emitTag("x");
+    OF.emitInteger(1);
+    OF.emitTag("label");
+    OF.emitString("origin");
+    OF.emitTag("z");
+    OF.emitInteger(0);
+  }
 
   return 0;
 }
@@ -0,0 +1,47 @@
+#!/bin/bash
+# Script to check that exports made with DETERMINISTIC=1 are byte-identical from one compilation to the next.
+# Usage: deterministic_test.sh OUTPUT_DIR SOURCE_FILE... -- COMMAND...
+# where COMMAND is a clang command line expecting the output file of the plugin, then '-c SOURCE_FILE'.
+# Each source file is exported twice: once as given, then from OUTPUT_DIR with an absolute path.
+# The two outputs are compared, and must not contain absolute paths (see MAKE_RELATIVE_TO).
+# A line is printed for each file that passes the check.
+
+OUTPUT_DIR="$1"
+shift
+
+SOURCES=()
+while [ -n "$1" ] && [ "$1" != "--" ]
+do
+    SOURCES+=("$1")
+    shift
+done
+shift
+
+COMMAND=("$@")
+# the second export runs from another directory
+if [[ "${COMMAND[0]}" == */* ]] && [[ "${COMMAND[0]}" != /* ]]; then
+    COMMAND[0]="$PWD/${COMMAND[0]}"
+fi
+
+mkdir -p "$OUTPUT_DIR"
+ABS_OUTPUT_DIR="$(cd "$OUTPUT_DIR" && pwd)"
+for SOURCE in "${SOURCES[@]}"
+do
+    OUTPUT="$ABS_OUTPUT_DIR/$(basename "$SOURCE")"
+    ABS_SOURCE="$(cd "$(dirname "$SOURCE")" && pwd)/$(basename "$SOURCE")"
+    "${COMMAND[@]}" "$OUTPUT.1" -c "$SOURCE" || exit 1
+    (cd "$ABS_OUTPUT_DIR" && "${COMMAND[@]}" "$OUTPUT.2" -c "$ABS_SOURCE") || exit 1
+    if ! cmp -s "$OUTPUT.1" "$OUTPUT.2"; then
+        echo "The exports of '$SOURCE' differ from one compilation to the next."
+        echo "Here is the command that shows the problem:"
+        echo "  diff \"$OUTPUT.1\" \"$OUTPUT.2\""
+        exit 2
+    fi
+    if grep -q '"/' "$OUTPUT.1"; then
+        echo "The export of '$SOURCE' contains absolute paths."
+        echo "Here is the command that shows the problem:"
+        echo "  grep '\"/' \"$OUTPUT.1\""
+        exit 2
+    fi
+    echo "$(basename "$SOURCE"): ok"
+done
@@ -0,0 +1,287 @@
+/**
+ * Copyright (c) 2015, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/**
+ * Command line tool to export an AST serialized by 'clang -emit-ast' without
+ * re-parsing the source file. Either the whole translation unit or a selection
+ * of declarations is exported. Declarations are selected by qualified name, by
+ * USR, or by source range.
+ *
+ * Usage: export_ast_file [-o OUTPUT] [--decl NAME]... [--usr USR]...
+ *                        [--range FILE:LINE[-LINE]]... AST_FILE [KEY=VALUE]...
+ *
+ * The KEY=VALUE arguments are the options of the ASTExporter plugin
+ * (e.g. USE_YOJSON=1). Whole translation units are exported like the plugin
+ * does, with their shards and side outputs. These only make sense for whole
+ * translation units, and are rejected for selections.
+ */
+
+#include <set>
+
+#include <clang/Basic/FileManager.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Index/USRGeneration.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+
+#include "ASTExporter.h"
+
+using namespace clang;
+using namespace ASTLib;
+
+static llvm::cl::opt<std::string>
+ASTFile(llvm::cl::Positional, llvm::cl::desc("<ast file>"), llvm::cl::Required);
+
+static llvm::cl::list<std::string>
+ExporterArgs(llvm::cl::Positional, llvm::cl::desc("[KEY=VALUE]..."));
+
+static llvm::cl::opt<std::string>
+OutputFile("o", llvm::cl::desc("Output file (default: stdout)"), llvm::cl::init("-"));
+
+static llvm::cl::list<std::string>
+DeclNames("decl", llvm::cl::desc("Export the declarations with this qualified name"));
+
+static llvm::cl::list<std::string>
+DeclUSRs("usr", llvm::cl::desc("Export the declaration with this USR"));
+
+static llvm::cl::list<std::string>
+DeclRanges("range", llvm::cl::desc("Export the top-level declarations overlapping FILE:LINE[-LINE]"));
+
+static void split(const std::string &Str, const std::string &Sep, std::vector<std::string> &Parts) {
+  size_t Start = 0, Pos;
+  while ((Pos = Str.find(Sep, Start)) != std::string::npos) {
+    Parts.push_back(Str.substr(Start, Pos - Start));
+    Start = Pos + Sep.size();
+  }
+  Parts.push_back(Str.substr(Start));
+}
+
+/// Looks up one component of a qualified name. Lookups go through the
+/// external source of the context, which only deserializes the matching
+/// declarations. Objective-C methods are named by their selectors.
+static DeclContext::lookup_result lookupName(ASTContext &Context, DeclContext *DC,
+                                             const std::string &Name) {
+  if (Name.find(':') != std::string::npos) {
+    std::vector<std::string> Pieces;
+    split(Name, ":", Pieces);
+    Pieces.pop_back();
+    SmallVector<IdentifierInfo*, 4> Idents;
+    for (const std::string &Piece : Pieces) {
+      Idents.push_back(&Context.Idents.get(Piece));
+    }
+    return DC->lookup(Context.Selectors.getSelector(Idents.size(), Idents.data()));
+  }
+  IdentifierInfo *II = &Context.Idents.get(Name);
+  DeclContext::lookup_result Result = DC->lookup(DeclarationName(II));
+  if (Result.empty() && isa<ObjCContainerDecl>(DC)) {
+    Result = DC->lookup(Context.Selectors.getNullarySelector(II));
+  }
+  return Result;
+}
+
+static void findDeclsByName(ASTContext &Context, const std::string &QualName,
+                            std::vector<const Decl*> &Decls) {
+  std::vector<std::string> Parts;
+  split(QualName, "::", Parts);
+  std::vector<DeclContext*> Contexts(1, Context.getTranslationUnitDecl());
+  for (size_t I = 0; I < Parts.size(); I++) {
+    bool IsLast = I + 1 == Parts.size();
+    std::vector<DeclContext*> NextContexts;
+    for (DeclContext *DC : Contexts) {
+      for (NamedDecl *ND : lookupName(Context, DC, Parts[I])) {
+        if (IsLast) {
+          Decls.push_back(ND);
+        } else if (DeclContext *Inner = dyn_cast<DeclContext>(ND)) {
+          NextContexts.push_back(Inner);
+        }
+      }
+    }
+    Contexts.swap(NextContexts);
+  }
+}
+
+/// USRs cannot be looked up directly, so this walks the declaration contexts
+/// of the translation unit. Function bodies are never deserialized.
+static void findDeclsByUSR(const DeclContext *DC, const std::set<std::string> &USRs,
+                           std::vector<const Decl*> &Decls) {
+  for (const Decl *D : DC->decls()) {
+    SmallString<128> USR;
+    if (!index::generateUSRForDecl(D, USR) && USRs.count(USR.str().str())) {
+      Decls.push_back(D);
+    }
+    if (isa<FunctionDecl>(D) || isa<ObjCMethodDecl>(D) || isa<BlockDecl>(D)) {
+      continue;
+    }
+    if (const DeclContext *Inner = dyn_cast<DeclContext>(D)) {
+      findDeclsByUSR(Inner, USRs, Decls);
+    }
+  }
+}
+
+/// Returns the name of an option that requires the whole translation unit, if
+/// one is set.
+static const char *getWholeTUOption(const ASTExporterOptions &Options) {
+  if (Options.shards > 1) {
+    return "SHARDS";
+  }
+  if (!Options.extraOutputs.empty()) {
+    return "ALSO_WRITE";
+  }
+  if (Options.declIndexFile != "") {
+    return "DECL_INDEX_FILE";
+  }
+  if (Options.bodyHashManifest != "") {
+    return "BODY_HASH_MANIFEST";
+  }
+  if (Options.referenceGraphFile != "") {
+    return "REFERENCE_GRAPH_FILE";
+  }
+  if (Options.profileFile != "") {
+    return "PROFILE_FILE";
+  }
+  if (Options.declContextsFile != "") {
+    return "DECL_CONTEXTS_FILE";
+  }
+  return nullptr;
+}
+
+/// Parses a line number of a range.
+static bool parseLine(const std::string &Str, unsigned &Line, std::string &Error) {
+  if (StringRef(Str).getAsInteger(10, Line) || Line == 0) {
+    Error = "'" + Str + "' is not a line number";
+    return false;
+  }
+  return true;
+}
+
+/// Uses the file-level declaration index of the AST file, so that only the
+/// declarations overlapping the range are deserialized.
+static bool findDeclsInRange(ASTUnit &AST, const std::string &Range,
+                             std::vector<const Decl*> &Decls, std::string &Error) {
+  size_t Colon = Range.rfind(':');
+  if (Colon == std::string::npos) {
+    Error = "expected FILE:LINE[-LINE]";
+    return false;
+  }
+  std::string FileName = Range.substr(0, Colon);
+  std::vector<std::string> Lines;
+  split(Range.substr(Colon + 1), "-", Lines);
+  if (Lines.size() > 2) {
+    Error = "expected FILE:LINE[-LINE]";
+    return false;
+  }
+  unsigned StartLine, EndLine;
+  if (!parseLine(Lines.front(), StartLine, Error) || !parseLine(Lines.back(), EndLine, Error)) {
+    return false;
+  }
+  if (EndLine < StartLine) {
+    Error = "the last line precedes the first one";
+    return false;
+  }
+  SourceManager &SM = AST.getSourceManager();
+  const FileEntry *File = AST.getFileManager().getFile(FileName);
+  if (!File) {
+    Error = "file not found";
+    return false;
+  }
+  FileID FID = SM.translateFile(File);
+  if (FID.isInvalid()) {
+    Error = "file not found in the AST";
+    return false;
+  }
+  SourceLocation Begin = SM.translateFileLineCol(File, StartLine, 1);
+  SourceLocation End = SM.translateFileLineCol(File, EndLine + 1, 1);
+  unsigned BeginOffset = SM.getFileOffset(Begin);
+  unsigned EndOffset = SM.getFileOffset(End);
+  SmallVector<Decl*, 16> Found;
+  AST.findFileRegionDecls(FID, BeginOffset, EndOffset - BeginOffset, Found);
+  for (const Decl *D : Found) {
+    // Keep the declarations that actually overlap the lines.
+    SourceRange R = D->getSourceRange();
+    if (R.isValid() &&
+        SM.getFileOffset(SM.getExpansionLoc(R.getEnd())) >= BeginOffset &&
+        SM.getFileOffset(SM.getExpansionLoc(R.getBegin())) < EndOffset) {
+      Decls.push_back(D);
+    }
+  }
+  return true;
+}
+
+int main(int argc, const char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Export a serialized clang AST\n");
+
+  IntrusiveRefCntPtr<DiagnosticsEngine> Diags =
+    CompilerInstance::createDiagnostics(new DiagnosticOptions());
+  std::unique_ptr<ASTUnit> AST = ASTUnit::LoadFromASTFile(ASTFile, Diags, FileSystemOptions(),
+                                                          /*OnlyLocalDecls=*/true);
+  if (!AST) {
+    llvm::errs() << "Failed to load AST file " << ASTFile << "\n";
+    return 1;
+  }
+
+  ASTExporterOptions Options;
+  Options.loadValuesFromEnvAndMap(ASTExporterOptions::makeMap(ExporterArgs));
+  Options.inputFile = AST->getOriginalSourceFileName();
+  Options.outputFile = OutputFile;
+
+  bool IsWholeTU = DeclNames.empty() && DeclUSRs.empty() && DeclRanges.empty();
+  if (!IsWholeTU) {
+    if (const char *Option = getWholeTUOption(Options)) {
+      llvm::errs() << Option << " cannot be used with a selection of declarations\n";
+      return 1;
+    }
+  }
+
+  std::vector<const Decl*> Selection;
+  for (const std::string &Name : DeclNames) {
+    findDeclsByName(AST->getASTContext(), Name, Selection);
+  }
+  if (!DeclUSRs.empty()) {
+    std::set<std::string> USRs(DeclUSRs.begin(), DeclUSRs.end());
+    findDeclsByUSR(AST->getASTContext().getTranslationUnitDecl(), USRs, Selection);
+  }
+  for (const std::string &Range : DeclRanges) {
+    std::string Error;
+    if (!findDeclsInRange(*AST, Range, Selection, Error)) {
+      llvm::errs() << "Invalid range " << Range << ": " << Error << "\n";
+      return 1;
+    }
+  }
+  // The same declaration may be selected several times.
+  std::set<const Decl*> Selected;
+  std::vector<const Decl*> UniqueSelection;
+  for (const Decl *D : Selection) {
+    if (Selected.insert(D).second) {
+      UniqueSelection.push_back(D);
+    }
+  }
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(OutputFile, EC, llvm::sys::fs::F_Text);
+  if (EC) {
+    llvm::errs() << "Failed to open output file " << OutputFile << ": " << EC.message() << "\n";
+    return 1;
+  }
+  ASTContext &Context = AST->getASTContext();
+  if (IsWholeTU) {
+    // The consumer reports its own errors.
+    ExporterASTConsumer<JsonWriter> Consumer(std::move(Options), OS);
+    Consumer.HandleTranslationUnit(Context);
+    return 0;
+  }
+  ASTExporter<JsonWriter> P(OS, Context, Options);
+  P.dumpDeclSelection(Context, UniqueSelection);
+  if (const char *Error = P.getWriter().validator().error()) {
+    llvm::errs() << "Malformed output " << OutputFile << ": " << Error << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Script printing an outline of an export, for tests that only check a few fields of the AST.
+# Usage: outline_test.sh AST_FILE [OUTLINE_OPTION...] -- COMMAND...
+# where COMMAND is a clang command line writing the Json AST to AST_FILE
+# and OUTLINE_OPTION are options of ast_outline.py.
+
+AST_FILE="$1"
+shift
+
+OUTLINE_OPTIONS=()
+while [ -n "$1" ] && [ "$1" != "--" ]
+do
+    OUTLINE_OPTIONS+=("$1")
+    shift
+done
+shift
+
+mkdir -p "$(dirname "$AST_FILE")"
+rm -f "$AST_FILE"
+"$@" || exit 1
+python "$(dirname "$0")/ast_outline.py" "$AST_FILE" "${OUTLINE_OPTIONS[@]}"
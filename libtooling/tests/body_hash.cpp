@@ -0,0 +1,9 @@
+bool yes() { return true; }
+bool no() { return false; }
+
+unsigned long size_int() { return sizeof(int); }
+unsigned long align_int() { return alignof(int); }
+unsigned long size_long() { return sizeof(long); }
+
+int next(int x) { return x + 1; }
+int successor(int x) { return x + 1; }
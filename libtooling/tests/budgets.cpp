@@ -0,0 +1,9 @@
+int a;
+int b;
+
+void empty() {}
+
+int large(int x) {
+  int y = x + 1;
+  return y * 2;
+}
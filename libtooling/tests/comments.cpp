@@ -0,0 +1,8 @@
+/** A */
+void f();
+
+/** B */
+void f() {}
+
+/// C
+int g;
@@ -0,0 +1,8 @@
+#include <stddef.h>
+
+struct Buffer {
+  char *data;
+  size_t size;
+};
+
+size_t capacity(const Buffer &b) { return b.size; }
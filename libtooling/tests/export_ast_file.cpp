@@ -0,0 +1,10 @@
+namespace ns {
+int f(int x);
+struct S {
+  int g();
+};
+}
+
+int h() { return 0; }
+
+int k;
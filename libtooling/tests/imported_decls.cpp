@@ -0,0 +1,6 @@
+#include "imported_decls.h"
+
+int use() {
+  g();
+  return ns::f(1) + ns::f(2.0) + v;
+}
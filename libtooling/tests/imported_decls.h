@@ -0,0 +1,14 @@
+#ifndef IMPORTED_DECLS_H
+#define IMPORTED_DECLS_H
+
+namespace ns {
+int f(int x);
+int f(double x);
+}
+
+void g();
+void g();
+
+extern int v;
+
+#endif
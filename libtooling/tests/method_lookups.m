@@ -0,0 +1,27 @@
+__attribute__((objc_root_class))
+@interface Root
+- (int)value;
+@end
+
+@implementation Root
+- (int)value { return 1; }
+@end
+
+@interface Child : Root
+- (int)make;
+- (int)twice;
+@end
+
+@interface Child (Factory)
++ (int)make;
+- (int)extra;
+@end
+
+@implementation Child
+- (int)make { return 2; }
+- (int)twice { return [self value] + [self value]; }
+@end
+
+int use(Root *r, Child *c) {
+  return [Child make] + [c make] + [r value] + [c value] + [c extra] + [c twice] + [c twice];
+}
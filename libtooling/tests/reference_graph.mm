@@ -0,0 +1,25 @@
+__attribute__((objc_root_class))
+@interface Counter
+- (int)next;
+@end
+
+@implementation Counter
+- (int)next { return 1; }
+@end
+
+__attribute__((objc_root_class))
+@interface Other
+- (int)unknown;
+@end
+
+struct Point {
+  Point(int x) : x(x) {}
+  int x;
+};
+
+int square(int x) { return x * x; }
+
+int use(Counter *c, id o) {
+  Point p(square(2));
+  return p.x + [c next] + [o unknown];
+}
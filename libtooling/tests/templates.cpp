@@ -0,0 +1,27 @@
+template <class T>
+struct Box {
+  T value;
+};
+
+template <>
+struct Box<long> {
+  int bits;
+};
+
+template <class T>
+T get(Box<T> b) {
+  return b.value;
+}
+
+int use_int(Box<int> b) {
+  return get(b);
+}
+
+template struct Box<char>;
+
+template <class T>
+T twice(T x) {
+  return x + x;
+}
+
+template int twice<int>(int x);